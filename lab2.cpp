@@ -10,263 +10,6708 @@
 #include <set>
 #include <map>
 #include <unordered_map>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <chrono>
+#include <climits>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <cmath>
+#include <tuple>
+#include <deque>
+#include <optional>
+#include <cstdio>
+#include <new>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#endif
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
 
 using namespace std;
 
-const string PIPE_IDENTIFIER = "[PIPE]";
-const string STATION_IDENTIFIER = "[STATION]";
+const string DELTA_BASE_IDENTIFIER = "[DELTA_BASE]";
+const size_t OUTPUT_BUFFER_SIZE = 1 << 16;
+const size_t IO_BLOCK_SIZE = 1 << 20;
+const size_t IO_BLOCK_ALIGNMENT = 4096;
+const unsigned IO_QUEUE_DEPTH = 4;
+const char ARROW_MAGIC[6] = { 'A', 'R', 'R', 'O', 'W', '1' };
+const size_t ARROW_ALIGNMENT = 64;
+const size_t ARROW_BATCH_ROWS = 1 << 16;
+const int16_t ARROW_METADATA_VERSION = 4;
+const uint8_t ARROW_HEADER_SCHEMA = 1;
+const uint8_t ARROW_HEADER_RECORD_BATCH = 3;
+const size_t DEFAULT_PAGE_SIZE = 50;
+const char SNAPSHOT_MAGIC[4] = { 'P', 'N', 'S', '6' };
+const int SHARD_COUNT = 16;
+const int REGION_ID_RANGE = 1000000;
+const int REGION_COUNT = INT_MAX / REGION_ID_RANGE;
+const string SHARD_IDENTIFIER = "[SHARD]";
+const size_t CHANGE_FEED_CAPACITY = 1 << 14;
+const int CHANGE_FEED_MAX_WAIT_MS = 100;
+const int CHANGE_FEED_POLL_MS = 10;
+const size_t CHANGE_FEED_SOCKET_BACKLOG = 16 << 20;
+const int REPLICATION_POLL_MS = 10;
+const int REPLICATION_HEARTBEAT_MS = 1000;
+const size_t REPLICATION_MAX_BACKLOG = 64 << 20;
+const size_t DEFAULT_VERSION_RETENTION = 1000000;
+const double SPATIAL_CELL_SIZE = 10.0;
+const double SPATIAL_MAX_PIPE_CELLS = 4096;
+const double SPATIAL_COORDINATE_LIMIT = 1e7;
+const double SIMULATION_STATION_VOLUME = 1000.0;
+const double SIMULATION_SOURCE_SUPPLY = 5.0;
+const double SIMULATION_SINK_DEMAND = 4.0;
+const double SIMULATION_COMPRESSOR_BOOST = 0.5;
+const double SIMULATION_CONDUCTANCE = 20.0;
+
+class Pipe;
+class CompressorStation;
+
+// Formats a double with the shortest digits that read back to the same value.
+struct ExactDouble {
+    double value;
+};
+
+// Collects formatted text in a reusable chunk and writes it to the stream
+// with a single call per chunk instead of one call per field.
+class OutputBuffer {
+private:
+    ostream& out;
+    vector<char> buffer;
+    size_t used = 0;
+
+    void reserveSpace(size_t size) {
+        if (used + size > buffer.size()) {
+            flush();
+            if (size > buffer.size()) {
+                buffer.resize(size);
+            }
+        }
+    }
 
-class Pipe {
 public:
-    int id = 0;
-    string name = "";
-    int length = 0;
-    int diameter = 0;
-    bool underRepair = false;
+    explicit OutputBuffer(ostream& out, size_t capacity = OUTPUT_BUFFER_SIZE) : out(out), buffer(capacity) {}
 
-    friend ostream& operator<<(ostream& out, const Pipe& pipe);
-    friend istream& operator>>(istream& in, Pipe& pipe);
+    ~OutputBuffer() {
+        flush();
+    }
+
+    void flush() {
+        if (used > 0) {
+            out.write(buffer.data(), used);
+            used = 0;
+        }
+    }
+
+    OutputBuffer& operator<<(const char* text) {
+        return append(text, char_traits<char>::length(text));
+    }
+
+    OutputBuffer& operator<<(const string& text) {
+        return append(text.data(), text.size());
+    }
+
+    OutputBuffer& operator<<(char symbol) {
+        reserveSpace(1);
+        buffer[used++] = symbol;
+        return *this;
+    }
+
+    template<typename T, typename = enable_if_t<is_integral_v<T> && !is_same_v<T, bool>>>
+    OutputBuffer& operator<<(T value) {
+        reserveSpace(24);
+        used = to_chars(buffer.data() + used, buffer.data() + buffer.size(), value).ptr - buffer.data();
+        return *this;
+    }
+
+    OutputBuffer& operator<<(double value) {
+        reserveSpace(32);
+        used = to_chars(buffer.data() + used, buffer.data() + buffer.size(), value, chars_format::general, 6).ptr - buffer.data();
+        return *this;
+    }
+
+    OutputBuffer& operator<<(ExactDouble number) {
+        reserveSpace(32);
+        used = to_chars(buffer.data() + used, buffer.data() + buffer.size(), number.value).ptr - buffer.data();
+        return *this;
+    }
+
+    OutputBuffer& append(const char* data, size_t size) {
+        reserveSpace(size);
+        copy(data, data + size, buffer.data() + used);
+        used += size;
+        return *this;
+    }
 };
 
-class CompressorStation {
+// Block-aligned buffer handed to the I/O backends.
+class IoBlock {
+private:
+    char* bytes;
+
 public:
-    int id = 0;
-    string name = "";
-    unsigned int totalWorkshops = 0;
-    unsigned int activeWorkshops = 0;
-    int stationClass = 0;
+    IoBlock() : bytes(static_cast<char*>(::operator new(IO_BLOCK_SIZE, align_val_t(IO_BLOCK_ALIGNMENT)))) {}
 
-    friend ostream& operator<<(ostream& out, const CompressorStation& station);
-    friend istream& operator>>(istream& in, CompressorStation& station);
+    IoBlock(IoBlock&& other) noexcept : bytes(other.bytes) {
+        other.bytes = nullptr;
+    }
+
+    IoBlock(const IoBlock&) = delete;
+    IoBlock& operator=(const IoBlock&) = delete;
+
+    ~IoBlock() {
+        if (bytes) {
+            ::operator delete(bytes, align_val_t(IO_BLOCK_ALIGNMENT));
+        }
+    }
+
+    char* data() const {
+        return bytes;
+    }
 };
 
-class DataManager {
+// Sequential file written in blocks: the caller fills nextBuffer() and
+// hands it over with submit(); the block may be written asynchronously.
+class OutputFile {
+public:
+    virtual ~OutputFile() = default;
+    virtual char* nextBuffer() = 0;
+    virtual bool submit(size_t size) = 0;
+    virtual bool flush() = 0;
+    virtual bool close() = 0;
+};
+
+// Sequential file read in blocks; each chunk stays valid until the next call.
+// next() returns false at the end of the file and on a read error; failed()
+// tells the two apart.
+class InputFile {
+public:
+    virtual ~InputFile() = default;
+    virtual bool next(const char*& data, size_t& size) = 0;
+    virtual bool failed() const = 0;
+};
+
+class IoBackend {
+public:
+    virtual ~IoBackend() = default;
+    virtual const char* name() const = 0;
+    virtual unique_ptr<OutputFile> create(const string& path, bool append) = 0;
+    virtual unique_ptr<InputFile> open(const string& path) = 0;
+};
+
+// Portable backend: synchronous stdio calls, one per block.
+class BufferedOutputFile : public OutputFile {
 private:
-    unordered_map<int, Pipe> pipes;
-    unordered_map<int, CompressorStation> stations;
-    unordered_set<int> usedPipeIds;
-    unordered_set<int> usedStationIds;
-    int nextPipeId = 1;
-    int nextStationId = 1;
+    FILE* file;
+    IoBlock block;
+    bool failed = false;
 
-    string toLower(const string& str) {
-        string result = str;
-        transform(result.begin(), result.end(), result.begin(), ::tolower);
-        return result;
+public:
+    explicit BufferedOutputFile(FILE* file) : file(file) {
+        setvbuf(file, nullptr, _IONBF, 0);
     }
 
-    int generateUniqueId(unordered_set<int>& usedIds, int& nextId) {
-        while (usedIds.find(nextId) != usedIds.end()) {
-            nextId++;
+    ~BufferedOutputFile() override {
+        close();
+    }
+
+    char* nextBuffer() override {
+        return block.data();
+    }
+
+    bool submit(size_t size) override {
+        if (size > 0 && fwrite(block.data(), 1, size, file) != size) {
+            failed = true;
         }
-        int newId = nextId;
-        usedIds.insert(newId);
-        nextId++;
-        return newId;
+        return !failed;
     }
 
-    void releaseId(unordered_set<int>& usedIds, int id) {
-        usedIds.erase(id);
+    bool flush() override {
+        return !failed;
+    }
+
+    bool close() override {
+        if (file) {
+            failed |= fclose(file) != 0;
+            file = nullptr;
+        }
+        return !failed;
     }
+};
+
+class BufferedInputFile : public InputFile {
+private:
+    FILE* file;
+    IoBlock block;
 
 public:
-    template<typename T>
-    T getValidatedNumber(const string& prompt, T minValue = 1, T maxValue = numeric_limits<T>::max()) {
-        string input;
-        T value;
+    explicit BufferedInputFile(FILE* file) : file(file) {
+        setvbuf(file, nullptr, _IONBF, 0);
+    }
 
-        while (true) {
-            cout << prompt;
-            getline(cin, input);
+    ~BufferedInputFile() override {
+        fclose(file);
+    }
 
-            stringstream ss(input);
+    bool next(const char*& data, size_t& size) override {
+        data = block.data();
+        size = fread(block.data(), 1, IO_BLOCK_SIZE, file);
+        return size > 0;
+    }
 
-            if (ss >> value) {
-                char remaining;
-                if (ss >> remaining) {
-                    cout << "Invalid input! Please enter only a number without extra characters.\n";
-                    continue;
-                }
+    bool failed() const override {
+        return ferror(file) != 0;
+    }
+};
 
-                if (value < minValue  value > maxValue) {
-                    cout << "Invalid input! Please enter a number between " << minValue << " and " << maxValue << ".\n";
-                    continue;
-                }
+class BufferedIoBackend : public IoBackend {
+public:
+    const char* name() const override {
+        return "buffered";
+    }
 
-                return value;
-            }
-            else {
-                cout << "Invalid input! Please enter a valid number.\n";
+    unique_ptr<OutputFile> create(const string& path, bool append) override {
+        FILE* file = fopen(path.c_str(), append ? "ab" : "wb");
+        return file ? make_unique<BufferedOutputFile>(file) : nullptr;
+    }
+
+    unique_ptr<InputFile> open(const string& path) override {
+        FILE* file = fopen(path.c_str(), "rb");
+        return file ? make_unique<BufferedInputFile>(file) : nullptr;
+    }
+};
+
+#ifdef __linux__
+// Minimal io_uring instance driven through the raw system calls. Used by a
+// single thread; at most `entries` requests are in flight at a time.
+class IoRing {
+private:
+    int ringFd = -1;
+    void* sqRing = MAP_FAILED;
+    void* cqRing = MAP_FAILED;
+    void* sqeArea = MAP_FAILED;
+    size_t sqRingSize = 0;
+    size_t cqRingSize = 0;
+    size_t sqeAreaSize = 0;
+    unsigned* sqHead = nullptr;
+    unsigned* sqTail = nullptr;
+    unsigned* sqMask = nullptr;
+    unsigned* sqArray = nullptr;
+    unsigned* cqHead = nullptr;
+    unsigned* cqTail = nullptr;
+    unsigned* cqMask = nullptr;
+    io_uring_cqe* cqes = nullptr;
+    io_uring_sqe* sqes = nullptr;
+
+    template<typename T>
+    static T* at(void* base, unsigned offset) {
+        return reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+    }
+
+    bool enter(unsigned toSubmit, unsigned minComplete, unsigned flags) {
+        while (syscall(__NR_io_uring_enter, ringFd, toSubmit, minComplete, flags, nullptr, 0) < 0) {
+            if (errno != EINTR) {
+                return false;
             }
         }
+        return true;
     }
 
-    double getValidatedDouble(const string& prompt, double minValue = 0.0, double maxValue = 100.0) {
-        string input;
-        double value;
+    void release() {
+        if (sqeArea != MAP_FAILED) {
+            munmap(sqeArea, sqeAreaSize);
+        }
+        if (cqRing != MAP_FAILED && cqRing != sqRing) {
+            munmap(cqRing, cqRingSize);
+        }
+        if (sqRing != MAP_FAILED) {
+            munmap(sqRing, sqRingSize);
+        }
+        if (ringFd >= 0) {
+            ::close(ringFd);
+        }
+        sqeArea = cqRing = sqRing = MAP_FAILED;
+        ringFd = -1;
+    }
 
-        while (true) {
-            cout << prompt;
-            getline(cin, input);
+public:
+    explicit IoRing(unsigned entries) {
+        io_uring_params params{};
+        ringFd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if (ringFd < 0) {
+            return;
+        }
 
-            stringstream ss(input);
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool singleMap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (singleMap) {
+            sqRingSize = cqRingSize = max(sqRingSize, cqRingSize);
+        }
+        sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+        cqRing = singleMap ? sqRing : mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+        sqeAreaSize = params.sq_entries * sizeof(io_uring_sqe);
+        sqeArea = mmap(nullptr, sqeAreaSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+        if (sqRing == MAP_FAILED || cqRing == MAP_FAILED || sqeArea == MAP_FAILED) {
+            release();
+            return;
+        }
 
-            if (ss >> value) {
-                char remaining;
-                if (ss >> remaining) {
-                    cout << "Invalid input! Please enter only a number without extra characters.\n";
-                    continue;
-                }
+        sqHead = at<unsigned>(sqRing, params.sq_off.head);
+        sqTail = at<unsigned>(sqRing, params.sq_off.tail);
+        sqMask = at<unsigned>(sqRing, params.sq_off.ring_mask);
+        sqArray = at<unsigned>(sqRing, params.sq_off.array);
+        cqHead = at<unsigned>(cqRing, params.cq_off.head);
+        cqTail = at<unsigned>(cqRing, params.cq_off.tail);
+        cqMask = at<unsigned>(cqRing, params.cq_off.ring_mask);
+        cqes = at<io_uring_cqe>(cqRing, params.cq_off.cqes);
+        sqes = static_cast<io_uring_sqe*>(sqeArea);
+    }
 
-                if (value < minValue  value > maxValue) {
-                    cout << "Invalid input! Please enter a number between " << minValue << " and " << maxValue << ".\n";
-                    continue;
-                }
+    IoRing(const IoRing&) = delete;
+    IoRing& operator=(const IoRing&) = delete;
 
-                return value;
-            }
-            else {
-                cout << "Invalid input! Please enter a valid number.\n";
-            }
+    ~IoRing() {
+        release();
+    }
+
+    bool isOpen() const {
+        return ringFd >= 0;
+    }
+
+    bool supports(uint8_t opcode) {
+        vector<char> storage(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op), 0);
+        io_uring_probe* probe = reinterpret_cast<io_uring_probe*>(storage.data());
+        if (syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_PROBE, probe, 256) < 0) {
+            return false;
         }
+        return opcode <= probe->last_op && (probe->ops[opcode].flags & IO_URING_OP_SUPPORTED);
     }
 
-    bool getConfirmation(const string& message) {
-        string input;
-        while (true) {
-            cout << message << " (y/n): ";
-            getline(cin, input);
+    bool submit(uint8_t opcode, int fd, void* data, size_t size, uint64_t offset, uint64_t tag) {
+        if (!isOpen()) {
+            return false;
+        }
+        unsigned tail = *sqTail;
+        unsigned index = tail & *sqMask;
+        io_uring_sqe& sqe = sqes[index];
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = opcode;
+        sqe.fd = fd;
+        sqe.addr = reinterpret_cast<uint64_t>(data);
+        sqe.len = static_cast<uint32_t>(size);
+        sqe.off = offset;
+        sqe.user_data = tag;
+        sqArray[index] = index;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+        enter(1, 0, 0);
 
-            if (input == "y"  input == "Y") {
+        // If the kernel did not take the entry, withdraw it: the caller falls
+        // back to a plain write and reuses the buffer, so the entry must never
+        // be submitted later.
+        if (__atomic_load_n(sqHead, __ATOMIC_ACQUIRE) == tail) {
+            __atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+            return false;
+        }
+        return true;
+    }
+
+    bool waitCompletion(uint64_t& tag, int& result) {
+        while (true) {
+            unsigned head = *cqHead;
+            if (head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+                const io_uring_cqe& cqe = cqes[head & *cqMask];
+                tag = cqe.user_data;
+                result = cqe.res;
+                __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
                 return true;
             }
-            else if (input == "n"  input == "N") {
+            if (!enter(0, 1, IORING_ENTER_GETEVENTS)) {
                 return false;
             }
-            else {
-                cout << "Invalid input! Please enter 'y' or 'n'.\n";
-            }
         }
     }
-void displayAllPipes() {
-        if (pipes.empty()) {
-            cout << "No pipes available.\n";
-            return;
-        }
+};
 
-        cout << "\n=== ALL PIPES ===\n";
-        for (const auto& pair : pipes) {
-            const Pipe& pipe = pair.second;
-            cout << pipe;
+static bool writeFully(int fd, const char* data, size_t size, uint64_t offset) {
+    while (size > 0) {
+        ssize_t written = pwrite(fd, data, size, static_cast<off_t>(offset));
+        if (written < 0 && errno == EINTR) {
+            continue;
         }
+        if (written <= 0) {
+            return false;
+        }
+        data += written;
+        size -= written;
+        offset += written;
     }
+    return true;
+}
 
-    void displayAllStations() {
-        if (stations.empty()) {
-            cout << "No stations available.\n";
-            return;
+static size_t readFully(int fd, char* data, size_t size, uint64_t offset) {
+    size_t total = 0;
+    while (total < size) {
+        ssize_t got = pread(fd, data + total, size - total, static_cast<off_t>(offset + total));
+        if (got < 0 && errno == EINTR) {
+            continue;
         }
-
-        cout << "\n=== ALL COMPRESSOR STATIONS ===\n";
-        for (const auto& pair : stations) {
-            const CompressorStation& station = pair.second;
-            cout << station;
+        if (got <= 0) {
+            break;
         }
+        total += got;
     }
+    return total;
+}
 
-    vector<int> findPipesByName(const string& searchName) {
-        vector<int> foundIds;
-        string searchNameLower = toLower(searchName);
-        
-        for (const auto& pair : pipes) {
-            if (toLower(pair.second.name).find(searchNameLower) != string::npos) {
-                foundIds.push_back(pair.first);
+// Keeps up to IO_QUEUE_DEPTH block writes in flight while the caller
+// formats the next block. Falls back to pwrite when a request cannot be queued.
+class UringOutputFile : public OutputFile {
+private:
+    struct Slot {
+        IoBlock block;
+        size_t size = 0;
+        uint64_t offset = 0;
+    };
+
+    int fd;
+    vector<Slot> slots;
+    IoRing ring;
+    size_t current = 0;
+    uint64_t offset;
+    bool failed = false;
+
+    bool completeOne() {
+        uint64_t tag;
+        int result;
+        if (!ring.waitCompletion(tag, result)) {
+            failed = true;
+            for (Slot& slot : slots) {
+                slot.size = 0;
             }
+            return false;
         }
-        
-        return foundIds;
+
+        Slot& slot = slots[tag];
+        if (result < 0) {
+            failed = true;
+        }
+        else if (static_cast<size_t>(result) < slot.size) {
+            failed |= !writeFully(fd, slot.block.data() + result, slot.size - result, slot.offset + result);
+        }
+        slot.size = 0;
+        return true;
     }
 
-    vector<int> findPipesByRepairStatus(bool status) {
-        vector<int> foundIds;
-        
-        for (const auto& pair : pipes) {
-            if (pair.second.underRepair == status) {
-                foundIds.push_back(pair.first);
+    bool drain() {
+        for (const Slot& slot : slots) {
+            while (slot.size > 0 && completeOne()) {
             }
         }
-        
-        return foundIds;
+        return !failed;
     }
 
-    void displayPipesByIds(const vector<int>& pipeIds) {
-        if (pipeIds.empty()) {
-            cout << "No pipes to display.\n";
-            return;
+public:
+    UringOutputFile(int fd, uint64_t offset) : fd(fd), slots(IO_QUEUE_DEPTH), ring(IO_QUEUE_DEPTH), offset(offset) {}
+
+    ~UringOutputFile() override {
+        close();
+    }
+
+    char* nextBuffer() override {
+        while (slots[current].size > 0 && completeOne()) {
         }
+        return slots[current].block.data();
+    }
 
-        cout << "\n=== FOUND PIPES ===\n";
-        for (int id : pipeIds) {
-            auto it = pipes.find(id);
-            if (it != pipes.end()) {
-                cout << it->second;
-            }
+    bool submit(size_t size) override {
+        if (size == 0) {
+            return !failed;
+        }
+        Slot& slot = slots[current];
+        if (ring.submit(IORING_OP_WRITE, fd, slot.block.data(), size, offset, current)) {
+            slot.size = size;
+            slot.offset = offset;
+        }
+        else {
+            failed |= !writeFully(fd, slot.block.data(), size, offset);
         }
-        cout << "Total found: " << pipeIds.size() << " pipe(s)\n";
+        offset += size;
+        current = (current + 1) % slots.size();
+        return !failed;
     }
 
-    void searchPipesByName() {
-        if (pipes.empty()) {
-            cout << "No pipes available to search!\n";
-            return;
+    bool flush() override {
+        return drain();
+    }
+
+    bool close() override {
+        if (fd >= 0) {
+            drain();
+            failed |= ::close(fd) != 0;
+            fd = -1;
         }
+        return !failed;
+    }
+};
 
-        string searchName;
-        cout << "Enter pipe name to search for: ";
-        getline(cin, searchName);
-        
-        vector<int> foundIds = findPipesByName(searchName);
-        
-        if (foundIds.empty()) {
-            cout << "No pipes found with name containing: " << searchName << "\n";
+// Reads ahead: the next IO_QUEUE_DEPTH blocks are requested while the
+// caller parses the current one.
+class UringInputFile : public InputFile {
+private:
+    struct Slot {
+        IoBlock block;
+        size_t size = 0;
+        uint64_t offset = 0;
+        bool scheduled = false;
+        bool pending = false;
+    };
+
+    int fd;
+    uint64_t fileSize;
+    vector<Slot> slots;
+    IoRing ring;
+    uint64_t nextOffset = 0;
+    size_t current = 0;
+    bool started = false;
+    bool readFailed = false;
+
+    void schedule(size_t index) {
+        Slot& slot = slots[index];
+        slot.scheduled = nextOffset < fileSize;
+        slot.pending = false;
+        if (!slot.scheduled) {
             return;
         }
-        
-        displayPipesByIds(foundIds);
+        slot.size = static_cast<size_t>(min<uint64_t>(IO_BLOCK_SIZE, fileSize - nextOffset));
+        slot.offset = nextOffset;
+        slot.pending = ring.submit(IORING_OP_READ, fd, slot.block.data(), slot.size, slot.offset, index);
+        if (!slot.pending) {
+            readFailed |= readFully(fd, slot.block.data(), slot.size, slot.offset) < slot.size;
+        }
+        nextOffset += slot.size;
     }
 
-    void searchPipesByRepairStatus() {
-        if (pipes.empty()) {
-            cout << "No pipes available to search!\n";
-            return;
+    bool completeOne() {
+        uint64_t tag;
+        int result;
+        if (!ring.waitCompletion(tag, result)) {
+            readFailed = true;
+            return false;
         }
 
-        cout << "Search for pipes:\n";
-        cout << "1. Under repair\n";
-        cout << "2. Operational\n";
-        int choice = getValidatedNumber("Choose status: ", 1, 2);
-        
-        bool searchStatus = (choice == 1);
-        vector<int> foundIds = findPipesByRepairStatus(searchStatus);
-        
-        if (foundIds.empty()) {
-            cout << "No pipes found with the selected status.\n";
-            return;
+        Slot& slot = slots[tag];
+        if (result < 0) {
+            readFailed = true;
         }
-        
-        displayPipesByIds(foundIds);
+        else if (static_cast<size_t>(result) < slot.size) {
+            size_t rest = slot.size - result;
+            readFailed |= readFully(fd, slot.block.data() + result, rest, slot.offset + result) < rest;
+        }
+        slot.pending = false;
+        return true;
     }
 
-    void batchEditPipes() {
-        if (pipes.empty()) {
-            cout << "No pipes available to edit!\n";
-            return;
+public:
+    UringInputFile(int fd, uint64_t fileSize) : fd(fd), fileSize(fileSize), slots(IO_QUEUE_DEPTH), ring(IO_QUEUE_DEPTH) {}
+
+    ~UringInputFile() override {
+        for (const Slot& slot : slots) {
+            while (slot.pending && completeOne()) {
+            }
         }
-cout << "\n=== BATCH PIPE EDITING ===\n";
-        cout << "1. Search by name\n";
-        cout << "2. Search by repair status\n";
-        cout << "0. Back to main menu\n";
-        
+        ::close(fd);
+    }
+
+    bool next(const char*& data, size_t& size) override {
+        if (!started) {
+            for (size_t i = 0; i < slots.size(); i++) {
+                schedule(i);
+            }
+            started = true;
+        }
+        else {
+            schedule((current + slots.size() - 1) % slots.size());
+        }
+
+        Slot& slot = slots[current];
+        while (slot.pending) {
+            if (!completeOne()) {
+                return false;
+            }
+        }
+        if (readFailed || !slot.scheduled) {
+            return false;
+        }
+
+        data = slot.block.data();
+        size = slot.size;
+        current = (current + 1) % slots.size();
+        return true;
+    }
+
+    bool failed() const override {
+        return readFailed;
+    }
+};
+
+class UringIoBackend : public IoBackend {
+public:
+    static bool isAvailable() {
+        IoRing ring(1);
+        return ring.isOpen() && ring.supports(IORING_OP_READ) && ring.supports(IORING_OP_WRITE);
+    }
+
+    const char* name() const override {
+        return "io_uring";
+    }
+
+    unique_ptr<OutputFile> create(const string& path, bool append) override {
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC | (append ? 0 : O_TRUNC), 0644);
+        if (fd < 0) {
+            return nullptr;
+        }
+        off_t offset = append ? lseek(fd, 0, SEEK_END) : 0;
+        return make_unique<UringOutputFile>(fd, offset < 0 ? 0 : offset);
+    }
+
+    unique_ptr<InputFile> open(const string& path) override {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat info;
+        if (fd < 0 || fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+            if (fd >= 0) {
+                ::close(fd);
+            }
+            return nullptr;
+        }
+        return make_unique<UringInputFile>(fd, info.st_size);
+    }
+};
+#endif
+
+IoBackend& ioBackend() {
+    static unique_ptr<IoBackend> backend = []() -> unique_ptr<IoBackend> {
+#ifdef __linux__
+        if (UringIoBackend::isAvailable()) {
+            return make_unique<UringIoBackend>();
+        }
+#endif
+        return make_unique<BufferedIoBackend>();
+    }();
+    return *backend;
+}
+
+// Stream adapters, so records are formatted and parsed with the usual
+// operators while the bytes go through the I/O backend.
+class OutputFileBuffer : public streambuf {
+private:
+    unique_ptr<OutputFile> file;
+    bool failed = false;
+
+    bool submitBlock() {
+        if (!file) {
+            return false;
+        }
+        failed |= !file->submit(pptr() - pbase());
+        char* block = file->nextBuffer();
+        setp(block, block + IO_BLOCK_SIZE);
+        return !failed;
+    }
+
+protected:
+    int overflow(int symbol) override {
+        if (!submitBlock()) {
+            return traits_type::eof();
+        }
+        if (!traits_type::eq_int_type(symbol, traits_type::eof())) {
+            *pptr() = traits_type::to_char_type(symbol);
+            pbump(1);
+        }
+        return traits_type::not_eof(symbol);
+    }
+
+    int sync() override {
+        return submitBlock() && file->flush() ? 0 : -1;
+    }
+
+public:
+    explicit OutputFileBuffer(unique_ptr<OutputFile> opened) : file(move(opened)) {
+        if (file) {
+            char* block = file->nextBuffer();
+            setp(block, block + IO_BLOCK_SIZE);
+        }
+    }
+
+    bool isOpen() const {
+        return file != nullptr;
+    }
+
+    bool close() {
+        if (file) {
+            failed |= !file->submit(pptr() - pbase());
+            failed |= !file->close();
+            file.reset();
+            setp(nullptr, nullptr);
+        }
+        return !failed;
+    }
+};
+
+class InputFileBuffer : public streambuf {
+private:
+    unique_ptr<InputFile> file;
+
+protected:
+    int underflow() override {
+        const char* data;
+        size_t size;
+        if (!file || !file->next(data, size)) {
+            return traits_type::eof();
+        }
+        char* start = const_cast<char*>(data);
+        setg(start, start, start + size);
+        return traits_type::to_int_type(*start);
+    }
+
+public:
+    explicit InputFileBuffer(unique_ptr<InputFile> opened) : file(move(opened)) {}
+
+    bool isOpen() const {
+        return file != nullptr;
+    }
+
+    bool failed() const {
+        return file && file->failed();
+    }
+};
+
+class FileOutput : public ostream {
+private:
+    OutputFileBuffer buffer;
+
+public:
+    explicit FileOutput(const string& path, bool append = false) : ostream(nullptr), buffer(ioBackend().create(path, append)) {
+        rdbuf(&buffer);
+        if (!buffer.isOpen()) {
+            setstate(failbit);
+        }
+    }
+
+    ~FileOutput() override {
+        buffer.close();
+    }
+
+    bool isOpen() const {
+        return buffer.isOpen();
+    }
+
+    void close() {
+        if (!buffer.close()) {
+            setstate(failbit);
+        }
+    }
+};
+
+class FileInput : public istream {
+private:
+    InputFileBuffer buffer;
+
+public:
+    explicit FileInput(const string& path) : istream(nullptr), buffer(ioBackend().open(path)) {
+        rdbuf(&buffer);
+        if (!buffer.isOpen()) {
+            setstate(failbit);
+        }
+    }
+
+    // True when reading stopped on an I/O error rather than at the end of the file.
+    bool readFailed() const {
+        return buffer.failed();
+    }
+};
+
+bool readWholeFile(const string& path, vector<uint8_t>& bytes) {
+    unique_ptr<InputFile> file = ioBackend().open(path);
+    if (!file) {
+        return false;
+    }
+    bytes.clear();
+    const char* data;
+    size_t size;
+    while (file->next(data, size)) {
+        bytes.insert(bytes.end(), data, data + size);
+    }
+    return !file->failed();
+}
+
+// Byte-level primitives of the columnar snapshot: LEB128 varints, zigzag
+// signed values and fixed-width bit packing.
+class ByteWriter {
+private:
+    vector<uint8_t> bytes;
+
+public:
+    const vector<uint8_t>& data() const {
+        return bytes;
+    }
+
+    void putByte(uint8_t value) {
+        bytes.push_back(value);
+    }
+
+    void putBytes(const void* data, size_t size) {
+        const uint8_t* begin = static_cast<const uint8_t*>(data);
+        bytes.insert(bytes.end(), begin, begin + size);
+    }
+
+    void putVarint(uint64_t value) {
+        while (value >= 0x80) {
+            bytes.push_back(static_cast<uint8_t>(value | 0x80));
+            value >>= 7;
+        }
+        bytes.push_back(static_cast<uint8_t>(value));
+    }
+
+    void putSigned(int64_t value) {
+        putVarint((static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+    }
+
+    void putBitPacked(const vector<uint64_t>& values, int width) {
+        putByte(static_cast<uint8_t>(width));
+        size_t start = bytes.size();
+        bytes.resize(start + (values.size() * width + 7) / 8 + 8);
+
+        size_t bit = 0;
+        for (uint64_t value : values) {
+            for (int written = 0; written < width; ) {
+                size_t index = start + (bit + written) / 8;
+                int shift = (bit + written) % 8;
+                int chunk = min(width - written, 8 - shift);
+                bytes[index] |= static_cast<uint8_t>(((value >> written) & ((1u << chunk) - 1)) << shift);
+                written += chunk;
+            }
+            bit += width;
+        }
+        bytes.resize(start + (bit + 7) / 8);
+    }
+
+    void putDoubles(const vector<double>& values) {
+        for (double value : values) {
+            uint64_t bits;
+            memcpy(&bits, &value, sizeof(bits));
+            for (int shift = 0; shift < 64; shift += 8) {
+                putByte(static_cast<uint8_t>(bits >> shift));
+            }
+        }
+    }
+
+    // Frame of reference: the minimum is stored once, the offsets are bit-packed.
+    void putFrameOfReference(const vector<int64_t>& values) {
+        int64_t minValue = values.empty() ? 0 : *min_element(values.begin(), values.end());
+        uint64_t maxOffset = 0;
+        vector<uint64_t> offsets;
+        offsets.reserve(values.size());
+        for (int64_t value : values) {
+            offsets.push_back(static_cast<uint64_t>(value - minValue));
+            maxOffset = max(maxOffset, offsets.back());
+        }
+
+        int width = 0;
+        while (width < 64 && (maxOffset >> width) != 0) {
+            width++;
+        }
+
+        putSigned(minValue);
+        putBitPacked(offsets, width);
+    }
+
+    // Sorted IDs are stored as the first value and the gaps between neighbours.
+    void putSortedIds(const vector<int>& ids) {
+        putVarint(ids.size());
+        int64_t previous = 0;
+        for (size_t i = 0; i < ids.size(); i++) {
+            if (i == 0) {
+                putSigned(ids[i]);
+            } else {
+                putVarint(static_cast<uint64_t>(static_cast<int64_t>(ids[i]) - previous));
+            }
+            previous = ids[i];
+        }
+    }
+
+    // Distinct strings are sorted and front coded; each row stores a packed dictionary index.
+    void putDictionary(const vector<const string*>& values) {
+        vector<string> dictionary;
+        dictionary.reserve(values.size());
+        for (const string* value : values) {
+            dictionary.push_back(*value);
+        }
+        sort(dictionary.begin(), dictionary.end());
+        dictionary.erase(unique(dictionary.begin(), dictionary.end()), dictionary.end());
+
+        putVarint(dictionary.size());
+        const string* previous = nullptr;
+        for (const string& entry : dictionary) {
+            size_t shared = 0;
+            if (previous != nullptr) {
+                size_t limit = min(previous->size(), entry.size());
+                while (shared < limit && (*previous)[shared] == entry[shared]) {
+                    shared++;
+                }
+            }
+            putVarint(shared);
+            putVarint(entry.size() - shared);
+            putBytes(entry.data() + shared, entry.size() - shared);
+            previous = &entry;
+        }
+
+        vector<uint64_t> indexes;
+        indexes.reserve(values.size());
+        for (const string* value : values) {
+            indexes.push_back(lower_bound(dictionary.begin(), dictionary.end(), *value) - dictionary.begin());
+        }
+
+        int width = 0;
+        while (dictionary.size() > 1 && ((dictionary.size() - 1) >> width) != 0) {
+            width++;
+        }
+        putBitPacked(indexes, width);
+    }
+};
+
+class ByteReader {
+private:
+    const uint8_t* current;
+    const uint8_t* end;
+    bool failed = false;
+
+    bool require(size_t size) {
+        if (failed || static_cast<size_t>(end - current) < size) {
+            failed = true;
+            return false;
+        }
+        return true;
+    }
+
+public:
+    ByteReader(const uint8_t* data, size_t size) : current(data), end(data + size) {}
+
+    bool ok() const {
+        return !failed;
+    }
+
+    uint8_t getByte() {
+        return require(1) ? *current++ : 0;
+    }
+
+    bool getBytes(void* data, size_t size) {
+        if (!require(size)) {
+            return false;
+        }
+        copy(current, current + size, static_cast<uint8_t*>(data));
+        current += size;
+        return true;
+    }
+
+    uint64_t getVarint() {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64 && require(1); shift += 7) {
+            uint8_t byte = *current++;
+            value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0) {
+                return value;
+            }
+        }
+        failed = true;
+        return 0;
+    }
+
+    int64_t getSigned() {
+        uint64_t value = getVarint();
+        return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+    }
+
+    bool getBitPacked(vector<uint64_t>& values, size_t count) {
+        int width = getByte();
+        size_t size = (count * width + 7) / 8;
+        if (width > 64 || !require(size)) {
+            failed = true;
+            return false;
+        }
+
+        values.resize(count);
+        const uint8_t* data = current;
+        size_t bit = 0;
+        uint64_t mask = width == 64 ? ~0ull : (1ull << width) - 1;
+        for (size_t i = 0; i < count; i++, bit += width) {
+            if (width <= 56 && bit / 8 + 8 <= size) {
+                uint64_t word;
+                memcpy(&word, data + bit / 8, sizeof(word));
+                values[i] = (word >> (bit % 8)) & mask;
+                continue;
+            }
+
+            uint64_t value = 0;
+            for (int read = 0; read < width; ) {
+                size_t index = (bit + read) / 8;
+                int shift = (bit + read) % 8;
+                int chunk = min(width - read, 8 - shift);
+                value |= static_cast<uint64_t>((data[index] >> shift) & ((1u << chunk) - 1)) << read;
+                read += chunk;
+            }
+            values[i] = value;
+        }
+        current += size;
+        return true;
+    }
+
+    bool getDoubles(vector<double>& values, size_t count) {
+        if (!require(count * 8)) {
+            return false;
+        }
+
+        values.resize(count);
+        for (size_t i = 0; i < count; i++) {
+            uint64_t bits = 0;
+            for (int shift = 0; shift < 64; shift += 8) {
+                bits |= static_cast<uint64_t>(*current++) << shift;
+            }
+            memcpy(&values[i], &bits, sizeof(bits));
+        }
+        return true;
+    }
+
+    bool getFrameOfReference(vector<int64_t>& values, size_t count) {
+        int64_t minValue = getSigned();
+        vector<uint64_t> offsets;
+        if (!getBitPacked(offsets, count)) {
+            return false;
+        }
+
+        values.resize(count);
+        for (size_t i = 0; i < count; i++) {
+            values[i] = minValue + static_cast<int64_t>(offsets[i]);
+        }
+        return true;
+    }
+
+    bool getSortedIds(vector<int>& ids) {
+        uint64_t count = getVarint();
+        if (!require(count)) {
+            return false;
+        }
+
+        ids.resize(count);
+        int64_t previous = 0;
+        for (size_t i = 0; i < count; i++) {
+            previous = i == 0 ? getSigned() : previous + static_cast<int64_t>(getVarint());
+            ids[i] = static_cast<int>(previous);
+        }
+        return ok();
+    }
+
+    bool getDictionary(vector<string>& values, size_t count) {
+        uint64_t size = getVarint();
+        if (!require(size)) {
+            return false;
+        }
+
+        vector<string> dictionary(size);
+        for (size_t i = 0; i < size; i++) {
+            uint64_t shared = getVarint();
+            uint64_t suffix = getVarint();
+            if (i == 0 ? shared != 0 : shared > dictionary[i - 1].size()) {
+                failed = true;
+            }
+            if (!require(suffix)) {
+                return false;
+            }
+            dictionary[i].reserve(shared + suffix);
+            if (i > 0) {
+                dictionary[i].assign(dictionary[i - 1], 0, shared);
+            }
+            dictionary[i].append(reinterpret_cast<const char*>(current), suffix);
+            current += suffix;
+        }
+
+        vector<uint64_t> indexes;
+        if (!getBitPacked(indexes, count)) {
+            return false;
+        }
+
+        values.resize(count);
+        for (size_t i = 0; i < count; i++) {
+            if (indexes[i] >= size) {
+                failed = true;
+                return false;
+            }
+            values[i] = dictionary[indexes[i]];
+        }
+        return true;
+    }
+};
+
+template<typename V>
+using UnsignedBits = conditional_t<sizeof(V) == 8, uint64_t, conditional_t<sizeof(V) == 4, uint32_t, conditional_t<sizeof(V) == 2, uint16_t, uint8_t>>>;
+
+template<typename V>
+void storeLittleEndian(uint8_t* out, V value) {
+    UnsignedBits<V> bits;
+    memcpy(&bits, &value, sizeof(V));
+    for (size_t i = 0; i < sizeof(V); i++) {
+        out[i] = static_cast<uint8_t>(bits >> (8 * i));
+    }
+}
+
+template<typename V>
+V loadLittleEndian(const uint8_t* in) {
+    UnsignedBits<V> bits = 0;
+    for (size_t i = 0; i < sizeof(V); i++) {
+        bits |= static_cast<UnsignedBits<V>>(static_cast<UnsignedBits<V>>(in[i]) << (8 * i));
+    }
+    V value;
+    memcpy(&value, &bits, sizeof(V));
+    return value;
+}
+
+// Minimal FlatBuffers encoder for Arrow IPC metadata. Objects are written
+// front to back: a table reserves slots for its references and each child
+// written later patches its slot, so every offset points forward.
+class FlatBufferBuilder {
+public:
+    // A table field; size 0 marks a reference filled in by a later call.
+    struct Field {
+        uint16_t id;
+        uint8_t size;
+        int64_t value;
+    };
+
+    static const size_t rootSlot = 0;
+
+private:
+    vector<uint8_t> bytes = vector<uint8_t>(4, 0);
+
+    void pad(size_t alignment) {
+        bytes.resize((bytes.size() + alignment - 1) / alignment * alignment, 0);
+    }
+
+    template<typename V>
+    void put(size_t at, V value) {
+        storeLittleEndian(bytes.data() + at, value);
+    }
+
+    template<typename V>
+    size_t append(V value) {
+        size_t at = bytes.size();
+        bytes.resize(at + sizeof(V));
+        put(at, value);
+        return at;
+    }
+
+    void patch(size_t slot, size_t target) {
+        put(slot, static_cast<uint32_t>(target - slot));
+    }
+
+public:
+    // Returns the positions of the reference slots, in the order given.
+    vector<size_t> table(size_t slot, vector<Field> fields) {
+        uint16_t slotCount = 0;
+        for (const Field& field : fields) {
+            slotCount = max<uint16_t>(slotCount, field.id + 1);
+        }
+        vector<size_t> order(fields.size());
+        for (size_t i = 0; i < order.size(); i++) {
+            order[i] = i;
+        }
+        stable_sort(order.begin(), order.end(), [&fields](size_t a, size_t b) {
+            return max<int>(fields[a].size, 4) > max<int>(fields[b].size, 4);
+        });
+
+        pad(2);
+        size_t vtable = bytes.size();
+        size_t vtableSize = 4 + 2 * slotCount;
+        bytes.resize(vtable + vtableSize, 0);
+        pad(4);
+        size_t start = append<int32_t>(0);
+        put(start, static_cast<int32_t>(start - vtable));
+
+        vector<size_t> positions(fields.size());
+        for (size_t i : order) {
+            const Field& field = fields[i];
+            pad(field.size == 0 ? 4 : field.size);
+            switch (field.size) {
+                case 0: positions[i] = append<uint32_t>(0); break;
+                case 1: positions[i] = append(static_cast<uint8_t>(field.value)); break;
+                case 2: positions[i] = append(static_cast<int16_t>(field.value)); break;
+                case 4: positions[i] = append(static_cast<int32_t>(field.value)); break;
+                default: positions[i] = append(field.value); break;
+            }
+            put(vtable + 4 + 2 * field.id, static_cast<uint16_t>(positions[i] - start));
+        }
+        put(vtable, static_cast<uint16_t>(vtableSize));
+        put(vtable + 2, static_cast<uint16_t>(bytes.size() - start));
+        patch(slot, start);
+
+        vector<size_t> slots;
+        for (size_t i = 0; i < fields.size(); i++) {
+            if (fields[i].size == 0) {
+                slots.push_back(positions[i]);
+            }
+        }
+        return slots;
+    }
+
+    // Vector of `count` references; returns their slots.
+    vector<size_t> tableVector(size_t slot, size_t count) {
+        pad(4);
+        patch(slot, append(static_cast<uint32_t>(count)));
+        vector<size_t> slots;
+        for (size_t i = 0; i < count; i++) {
+            slots.push_back(append<uint32_t>(0));
+        }
+        return slots;
+    }
+
+    void text(size_t slot, const string& value) {
+        pad(4);
+        patch(slot, append(static_cast<uint32_t>(value.size())));
+        bytes.insert(bytes.end(), value.begin(), value.end());
+        bytes.push_back(0);
+    }
+
+    // Vector of structs made of 8-byte words.
+    void structVector(size_t slot, const vector<int64_t>& words, size_t wordsPerStruct) {
+        pad(4);
+        if ((bytes.size() + 4) % 8 != 0) {
+            append<uint32_t>(0);
+        }
+        patch(slot, append(static_cast<uint32_t>(words.size() / wordsPerStruct)));
+        for (int64_t word : words) {
+            append(word);
+        }
+    }
+
+    const vector<uint8_t>& data() const {
+        return bytes;
+    }
+};
+
+// Read side of FlatBufferBuilder. Every access is bounds-checked; missing
+// or malformed parts read as absent.
+class FlatTable {
+private:
+    const uint8_t* base = nullptr;
+    size_t size = 0;
+    size_t start = 0;
+
+    template<typename V>
+    bool load(size_t at, V& value) const {
+        if (at > size || sizeof(V) > size - at) {
+            return false;
+        }
+        value = loadLittleEndian<V>(base + at);
+        return true;
+    }
+
+    // Position of field `id`, or 0 if the table does not have it.
+    size_t fieldPosition(uint16_t id) const {
+        int32_t vtableOffset;
+        uint16_t vtableSize, fieldOffset;
+        if (!base || !load(start, vtableOffset)) {
+            return 0;
+        }
+        int64_t vtable = static_cast<int64_t>(start) - vtableOffset;
+        if (vtable < 0 || !load(static_cast<size_t>(vtable), vtableSize) || 4 + 2 * static_cast<size_t>(id) + 2 > vtableSize
+            || !load(static_cast<size_t>(vtable) + 4 + 2 * id, fieldOffset) || fieldOffset == 0) {
+            return 0;
+        }
+        return start + fieldOffset;
+    }
+
+    size_t follow(size_t slot) const {
+        uint32_t offset;
+        return slot != 0 && load(slot, offset) && offset != 0 ? slot + offset : 0;
+    }
+
+    size_t vectorStart(uint16_t id, size_t elementSize, size_t& length) const {
+        size_t target = follow(fieldPosition(id));
+        uint32_t count;
+        if (target == 0 || !load(target, count) || count * elementSize > size - target - 4) {
+            length = 0;
+            return 0;
+        }
+        length = count;
+        return target + 4;
+    }
+
+public:
+    FlatTable() = default;
+
+    FlatTable(const uint8_t* base, size_t size, size_t start) : base(base), size(size), start(start) {}
+
+    static FlatTable root(const uint8_t* base, size_t size) {
+        FlatTable buffer(base, size, 0);
+        uint32_t start;
+        return buffer.load(0, start) && start != 0 ? FlatTable(base, size, start) : FlatTable();
+    }
+
+    bool isValid() const {
+        return base != nullptr;
+    }
+
+    bool has(uint16_t id) const {
+        return fieldPosition(id) != 0;
+    }
+
+    template<typename V>
+    V scalar(uint16_t id, V fallback = V()) const {
+        V value;
+        size_t at = fieldPosition(id);
+        return at != 0 && load(at, value) ? value : fallback;
+    }
+
+    FlatTable table(uint16_t id) const {
+        size_t target = follow(fieldPosition(id));
+        return target != 0 ? FlatTable(base, size, target) : FlatTable();
+    }
+
+    string text(uint16_t id) const {
+        size_t length;
+        size_t first = vectorStart(id, 1, length);
+        return first != 0 ? string(reinterpret_cast<const char*>(base + first), length) : string();
+    }
+
+    vector<FlatTable> tables(uint16_t id) const {
+        size_t length;
+        size_t first = vectorStart(id, 4, length);
+        vector<FlatTable> result;
+        for (size_t i = 0; i < length; i++) {
+            size_t target = follow(first + 4 * i);
+            result.push_back(target != 0 ? FlatTable(base, size, target) : FlatTable());
+        }
+        return result;
+    }
+
+    vector<int64_t> structWords(uint16_t id, size_t wordsPerStruct) const {
+        size_t length;
+        size_t first = vectorStart(id, 8 * wordsPerStruct, length);
+        vector<int64_t> words(length * wordsPerStruct);
+        for (size_t i = 0; i < words.size(); i++) {
+            load(first + 8 * i, words[i]);
+        }
+        return words;
+    }
+};
+
+// Type tags of the Arrow schema union used by the exported columns.
+enum class ArrowType : uint8_t { Int = 2, FloatingPoint = 3, Utf8 = 5, Bool = 6 };
+
+struct ArrowField {
+    string name;
+    ArrowType type;
+    int bitWidth;
+    bool isSigned;
+};
+
+template<typename Value>
+ArrowField arrowFieldOf(const string& name) {
+    if constexpr (is_same_v<Value, string>) {
+        return { name, ArrowType::Utf8, 0, false };
+    } else if constexpr (is_same_v<Value, bool>) {
+        return { name, ArrowType::Bool, 1, false };
+    } else if constexpr (is_floating_point_v<Value>) {
+        return { name, ArrowType::FloatingPoint, static_cast<int>(8 * sizeof(Value)), true };
+    } else {
+        return { name, ArrowType::Int, static_cast<int>(8 * sizeof(Value)), is_signed_v<Value> };
+    }
+}
+
+// Buffers of one column in a record batch; `offsets` is used by strings only.
+struct ArrowColumn {
+    vector<uint8_t> offsets;
+    vector<uint8_t> values;
+};
+
+// One column of a record batch inside the file bytes.
+struct ArrowColumnView {
+    ArrowField field;
+    size_t length = 0;
+    const uint8_t* validity = nullptr;
+    const uint8_t* offsets = nullptr;
+    const uint8_t* values = nullptr;
+    size_t valuesSize = 0;
+
+    bool isNull(size_t row) const {
+        return validity && !(validity[row / 8] & (1 << (row % 8)));
+    }
+
+    bool flag(size_t row) const {
+        return values[row / 8] & (1 << (row % 8));
+    }
+
+    // False if the value is not a whole number that fits in int64_t.
+    bool integer(size_t row, int64_t& value) const {
+        if (field.type == ArrowType::FloatingPoint) {
+            double number = real(row);
+            if (!(number >= -0x1p63 && number < 0x1p63) || number != trunc(number)) {
+                return false;
+            }
+            value = static_cast<int64_t>(number);
+            return true;
+        }
+        if (field.type == ArrowType::Bool) {
+            value = flag(row);
+            return true;
+        }
+        const uint8_t* at = values + row * field.bitWidth / 8;
+        switch (field.bitWidth) {
+            case 8: value = field.isSigned ? int64_t(static_cast<int8_t>(*at)) : int64_t(*at); return true;
+            case 16: value = field.isSigned ? int64_t(loadLittleEndian<int16_t>(at)) : int64_t(loadLittleEndian<uint16_t>(at)); return true;
+            case 32: value = field.isSigned ? int64_t(loadLittleEndian<int32_t>(at)) : int64_t(loadLittleEndian<uint32_t>(at)); return true;
+            default: value = loadLittleEndian<int64_t>(at); return field.isSigned || value >= 0;
+        }
+    }
+
+    double real(size_t row) const {
+        if (field.type == ArrowType::FloatingPoint) {
+            return field.bitWidth == 32 ? loadLittleEndian<float>(values + 4 * row) : loadLittleEndian<double>(values + 8 * row);
+        }
+        if (field.type == ArrowType::Int && field.bitWidth == 64 && !field.isSigned) {
+            return static_cast<double>(loadLittleEndian<uint64_t>(values + 8 * row));
+        }
+        int64_t value = 0;
+        integer(row, value);
+        return static_cast<double>(value);
+    }
+
+    string text(size_t row) const {
+        size_t first = min<size_t>(loadLittleEndian<uint32_t>(offsets + 4 * row), valuesSize);
+        size_t last = min<size_t>(loadLittleEndian<uint32_t>(offsets + 4 * row + 4), valuesSize);
+        return first < last ? string(reinterpret_cast<const char*>(values + first), last - first) : string();
+    }
+};
+
+// Writes the Arrow IPC file format: magic, schema message, one message per
+// record batch, end-of-stream marker and a footer indexing the batches.
+// Buffers are 64-byte aligned in the file, so readers can map them as is.
+class ArrowFileWriter {
+private:
+    ostream& out;
+    vector<ArrowField> fields;
+    uint64_t position = 0;
+    vector<int64_t> blocks;
+
+    void writeBytes(const void* data, size_t size) {
+        out.write(static_cast<const char*>(data), size);
+        position += size;
+    }
+
+    void padTo(size_t alignment) {
+        static const char zeros[ARROW_ALIGNMENT] = {};
+        writeBytes(zeros, (alignment - position % alignment) % alignment);
+    }
+
+    void writeInt32(int32_t value) {
+        uint8_t bytes[4];
+        storeLittleEndian(bytes, value);
+        writeBytes(bytes, sizeof(bytes));
+    }
+
+    static size_t message(FlatBufferBuilder& builder, uint8_t headerType, int64_t bodyLength) {
+        return builder.table(FlatBufferBuilder::rootSlot, {
+            { 0, 2, ARROW_METADATA_VERSION }, { 1, 1, headerType }, { 2, 0, 0 }, { 3, 8, bodyLength } })[0];
+    }
+
+    void addSchema(FlatBufferBuilder& builder, size_t slot) const {
+        vector<size_t> fieldSlots = builder.tableVector(builder.table(slot, { { 1, 0, 0 } })[0], fields.size());
+        for (size_t i = 0; i < fields.size(); i++) {
+            const ArrowField& field = fields[i];
+            vector<size_t> slots = builder.table(fieldSlots[i], {
+                { 0, 0, 0 }, { 1, 1, 0 }, { 2, 1, static_cast<int64_t>(field.type) }, { 3, 0, 0 }, { 5, 0, 0 } });
+            builder.text(slots[0], field.name);
+            if (field.type == ArrowType::Int) {
+                builder.table(slots[1], { { 0, 4, field.bitWidth }, { 1, 1, field.isSigned } });
+            } else if (field.type == ArrowType::FloatingPoint) {
+                builder.table(slots[1], { { 0, 2, field.bitWidth == 32 ? 1 : 2 } });
+            } else {
+                builder.table(slots[1], {});
+            }
+            builder.tableVector(slots[2], 0);
+        }
+    }
+
+    // Writes the encapsulated metadata, padded so the body starts aligned.
+    int64_t writeMetadata(const vector<uint8_t>& metadata) {
+        uint64_t bodyStart = (position + 8 + metadata.size() + ARROW_ALIGNMENT - 1) / ARROW_ALIGNMENT * ARROW_ALIGNMENT;
+        uint64_t start = position;
+        writeInt32(-1);
+        writeInt32(static_cast<int32_t>(bodyStart - start - 8));
+        writeBytes(metadata.data(), metadata.size());
+        padTo(ARROW_ALIGNMENT);
+        return static_cast<int64_t>(position - start);
+    }
+
+public:
+    ArrowFileWriter(ostream& out, vector<ArrowField> schema) : out(out), fields(move(schema)) {
+        writeBytes(ARROW_MAGIC, sizeof(ARROW_MAGIC));
+        padTo(8);
+        FlatBufferBuilder builder;
+        addSchema(builder, message(builder, ARROW_HEADER_SCHEMA, 0));
+        writeMetadata(builder.data());
+    }
+
+    void writeBatch(size_t rows, const vector<ArrowColumn>& columns) {
+        vector<int64_t> nodes, buffers;
+        int64_t bodyLength = 0;
+        auto addBuffer = [&](size_t size) {
+            buffers.push_back(bodyLength);
+            buffers.push_back(static_cast<int64_t>(size));
+            bodyLength += (size + ARROW_ALIGNMENT - 1) / ARROW_ALIGNMENT * ARROW_ALIGNMENT;
+        };
+        for (size_t i = 0; i < fields.size(); i++) {
+            nodes.push_back(static_cast<int64_t>(rows));
+            nodes.push_back(0);
+            addBuffer(0);
+            if (fields[i].type == ArrowType::Utf8) {
+                addBuffer(columns[i].offsets.size());
+            }
+            addBuffer(columns[i].values.size());
+        }
+
+        FlatBufferBuilder builder;
+        vector<size_t> slots = builder.table(message(builder, ARROW_HEADER_RECORD_BATCH, bodyLength), {
+            { 0, 8, static_cast<int64_t>(rows) }, { 1, 0, 0 }, { 2, 0, 0 } });
+        builder.structVector(slots[0], nodes, 2);
+        builder.structVector(slots[1], buffers, 2);
+
+        int64_t offset = static_cast<int64_t>(position);
+        int64_t metadataLength = writeMetadata(builder.data());
+        for (const ArrowColumn& column : columns) {
+            writeBytes(column.offsets.data(), column.offsets.size());
+            padTo(ARROW_ALIGNMENT);
+            writeBytes(column.values.data(), column.values.size());
+            padTo(ARROW_ALIGNMENT);
+        }
+        blocks.insert(blocks.end(), { offset, metadataLength, bodyLength });
+    }
+
+    void finish() {
+        writeInt32(-1);
+        writeInt32(0);
+
+        FlatBufferBuilder builder;
+        vector<size_t> slots = builder.table(FlatBufferBuilder::rootSlot, {
+            { 0, 2, ARROW_METADATA_VERSION }, { 1, 0, 0 }, { 2, 0, 0 }, { 3, 0, 0 } });
+        addSchema(builder, slots[0]);
+        builder.structVector(slots[1], {}, 3);
+        builder.structVector(slots[2], blocks, 3);
+        writeBytes(builder.data().data(), builder.data().size());
+        writeInt32(static_cast<int32_t>(builder.data().size()));
+        writeBytes(ARROW_MAGIC, sizeof(ARROW_MAGIC));
+    }
+};
+
+// Reads Arrow IPC files with uncompressed Int, FloatingPoint, Bool and Utf8
+// columns straight from the file bytes.
+class ArrowFileReader {
+private:
+    const uint8_t* data;
+    size_t size;
+    vector<ArrowField> fields;
+    vector<int64_t> blocks;
+
+    static bool readField(const FlatTable& table, ArrowField& field) {
+        FlatTable type = table.table(3);
+        field.name = table.text(0);
+        field.type = static_cast<ArrowType>(table.scalar<uint8_t>(2));
+        field.bitWidth = 0;
+        field.isSigned = false;
+        if (table.has(4)) {
+            return false;
+        }
+        switch (field.type) {
+            case ArrowType::Int:
+                field.bitWidth = type.scalar<int32_t>(0);
+                field.isSigned = type.scalar<uint8_t>(1) != 0;
+                return field.bitWidth == 8 || field.bitWidth == 16 || field.bitWidth == 32 || field.bitWidth == 64;
+            case ArrowType::FloatingPoint: {
+                int16_t precision = type.scalar<int16_t>(0);
+                field.bitWidth = precision == 1 ? 32 : 64;
+                field.isSigned = true;
+                return precision == 1 || precision == 2;
+            }
+            case ArrowType::Utf8:
+            case ArrowType::Bool:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    bool inFile(const uint8_t* start, uint64_t length) const {
+        return start >= data && start <= data + size && length <= static_cast<uint64_t>(data + size - start);
+    }
+
+public:
+    ArrowFileReader(const uint8_t* data, size_t size) : data(data), size(size) {}
+
+    bool open() {
+        const size_t trailer = sizeof(ARROW_MAGIC) + 4;
+        if (size < 8 + trailer || !equal(ARROW_MAGIC, ARROW_MAGIC + sizeof(ARROW_MAGIC), data)
+            || !equal(ARROW_MAGIC, ARROW_MAGIC + sizeof(ARROW_MAGIC), data + size - sizeof(ARROW_MAGIC))) {
+            return false;
+        }
+        int32_t footerSize = loadLittleEndian<int32_t>(data + size - trailer);
+        if (footerSize <= 0 || static_cast<size_t>(footerSize) > size - trailer - 8) {
+            return false;
+        }
+
+        FlatTable footer = FlatTable::root(data + size - trailer - footerSize, footerSize);
+        vector<FlatTable> schema = footer.table(1).tables(1);
+        if (schema.empty()) {
+            return false;
+        }
+        fields.resize(schema.size());
+        for (size_t i = 0; i < schema.size(); i++) {
+            if (!readField(schema[i], fields[i])) {
+                return false;
+            }
+        }
+        blocks = footer.structWords(3, 3);
+        return footer.structWords(2, 3).empty();
+    }
+
+    const vector<ArrowField>& schema() const {
+        return fields;
+    }
+
+    int findColumn(const string& name) const {
+        for (size_t i = 0; i < fields.size(); i++) {
+            if (fields[i].name == name) {
+                return static_cast<int>(i);
+            }
+        }
+        return -1;
+    }
+
+    size_t batchCount() const {
+        return blocks.size() / 3;
+    }
+
+    bool readBatch(size_t index, vector<ArrowColumnView>& columns) const {
+        int64_t offset = blocks[3 * index];
+        int32_t metadataLength = static_cast<int32_t>(blocks[3 * index + 1]);
+        int64_t bodyLength = blocks[3 * index + 2];
+        if (offset < 0 || metadataLength < 8 || bodyLength < 0 || !inFile(data + offset, metadataLength)) {
+            return false;
+        }
+
+        const uint8_t* metadata = data + offset;
+        size_t prefix = loadLittleEndian<int32_t>(metadata) == -1 ? 8 : 4;
+        FlatTable message = FlatTable::root(metadata + prefix, metadataLength - prefix);
+        FlatTable batch = message.table(2);
+        if (message.scalar<uint8_t>(1) != ARROW_HEADER_RECORD_BATCH || !batch.isValid() || batch.has(3)) {
+            return false;
+        }
+
+        const uint8_t* body = metadata + metadataLength;
+        if (!inFile(body, static_cast<uint64_t>(bodyLength))) {
+            return false;
+        }
+        int64_t rows = batch.scalar<int64_t>(0);
+        vector<int64_t> nodes = batch.structWords(1, 2);
+        vector<int64_t> buffers = batch.structWords(2, 2);
+        if (rows < 0 || nodes.size() != 2 * fields.size()) {
+            return false;
+        }
+
+        size_t nextBuffer = 0;
+        auto takeBuffer = [&](uint64_t required, size_t& length) -> const uint8_t* {
+            if (2 * nextBuffer + 1 >= buffers.size()) {
+                return nullptr;
+            }
+            int64_t start = buffers[2 * nextBuffer];
+            int64_t bufferLength = buffers[2 * nextBuffer + 1];
+            nextBuffer++;
+            if (start < 0 || bufferLength < 0 || static_cast<uint64_t>(bufferLength) < required
+                || start > bodyLength || bufferLength > bodyLength - start) {
+                return nullptr;
+            }
+            length = static_cast<size_t>(bufferLength);
+            return body + start;
+        };
+
+        columns.assign(fields.size(), ArrowColumnView());
+        for (size_t i = 0; i < fields.size(); i++) {
+            ArrowColumnView& column = columns[i];
+            column.field = fields[i];
+            column.length = static_cast<size_t>(rows);
+            if (nodes[2 * i] != rows) {
+                return false;
+            }
+
+            size_t length;
+            uint64_t bitmapSize = (column.length + 7) / 8;
+            const uint8_t* validity = takeBuffer(0, length);
+            if (!validity) {
+                return false;
+            }
+            if (nodes[2 * i + 1] > 0) {
+                if (length < bitmapSize) {
+                    return false;
+                }
+                column.validity = validity;
+            }
+
+            if (column.field.type == ArrowType::Utf8) {
+                column.offsets = takeBuffer(4 * (column.length + 1), length);
+                column.values = takeBuffer(0, column.valuesSize);
+                if (!column.offsets || !column.values) {
+                    return false;
+                }
+            } else {
+                uint64_t required = column.field.type == ArrowType::Bool ? bitmapSize : column.length * column.field.bitWidth / 8;
+                column.values = takeBuffer(required, column.valuesSize);
+                if (!column.values) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+};
+
+struct PageRequest {
+    size_t offset = 0;
+    size_t limit = DEFAULT_PAGE_SIZE;
+    bool descending = false;
+};
+
+class Pipe {
+public:
+    int id = 0;
+    string name = "";
+    int length = 0;
+    int diameter = 0;
+    bool underRepair = false;
+    int startStationId = 0;
+    int endStationId = 0;
+    double startX = 0.0;
+    double startY = 0.0;
+    double endX = 0.0;
+    double endY = 0.0;
+    bool geometryKnown = false;
+
+    bool hasGeometry() const {
+        return geometryKnown;
+    }
+
+    friend ostream& operator<<(ostream& out, const Pipe& pipe);
+    friend OutputBuffer& operator<<(OutputBuffer& out, const Pipe& pipe);
+    friend istream& operator>>(istream& in, Pipe& pipe);
+};
+
+class CompressorStation {
+public:
+    int id = 0;
+    string name = "";
+    unsigned int totalWorkshops = 0;
+    unsigned int activeWorkshops = 0;
+    int stationClass = 0;
+    double x = 0.0;
+    double y = 0.0;
+    bool locationKnown = false;
+
+    bool hasLocation() const {
+        return locationKnown;
+    }
+
+    friend ostream& operator<<(ostream& out, const CompressorStation& station);
+    friend OutputBuffer& operator<<(OutputBuffer& out, const CompressorStation& station);
+    friend istream& operator>>(istream& in, CompressorStation& station);
+};
+
+// Runs task(0..count-1) on up to hardware_concurrency threads.
+template<typename Task>
+void parallelFor(size_t count, Task task) {
+    size_t threadCount = min<size_t>(count, max(1u, thread::hardware_concurrency()));
+    if (threadCount <= 1) {
+        for (size_t i = 0; i < count; i++) {
+            task(i);
+        }
+        return;
+    }
+
+    atomic<size_t> next(0);
+    vector<thread> workers;
+    for (size_t t = 0; t < threadCount; t++) {
+        workers.emplace_back([&]() {
+            for (size_t i = next++; i < count; i = next++) {
+                task(i);
+            }
+        });
+    }
+    for (thread& worker : workers) {
+        worker.join();
+    }
+}
+
+// Records partitioned into regions by ID range: region r owns IDs
+// r * REGION_ID_RANGE + 1 to (r + 1) * REGION_ID_RANGE. Within a region they
+// are spread over SHARD_COUNT shards by ID modulo the shard count, so
+// sequentially allocated IDs fill every shard of the region evenly. Each shard
+// is an independent hash map, so shards can be scanned, loaded and saved in
+// parallel.
+template<typename T>
+class ShardedMap {
+public:
+    using Shard = unordered_map<int, T>;
+
+private:
+    map<int, Shard> shards;
+    size_t recordCount = 0;
+
+    template<bool IsConst>
+    class Iterator {
+    private:
+        using OuterIterator = conditional_t<IsConst, typename map<int, Shard>::const_iterator, typename map<int, Shard>::iterator>;
+        using InnerIterator = conditional_t<IsConst, typename Shard::const_iterator, typename Shard::iterator>;
+
+        OuterIterator outer;
+        OuterIterator outerEnd;
+        InnerIterator inner;
+
+        void skipEmptyShards() {
+            while (outer != outerEnd && inner == outer->second.end()) {
+                if (++outer != outerEnd) {
+                    inner = outer->second.begin();
+                }
+            }
+        }
+
+        friend class ShardedMap;
+        friend class Iterator<true>;
+
+    public:
+        using value_type = typename Shard::value_type;
+        using reference = conditional_t<IsConst, const value_type&, value_type&>;
+        using pointer = conditional_t<IsConst, const value_type*, value_type*>;
+
+        Iterator() = default;
+
+        Iterator(OuterIterator outer, OuterIterator outerEnd, InnerIterator inner) : outer(outer), outerEnd(outerEnd), inner(inner) {
+            skipEmptyShards();
+        }
+
+        template<bool OtherConst, typename = enable_if_t<IsConst && !OtherConst>>
+        Iterator(const Iterator<OtherConst>& other) : outer(other.outer), outerEnd(other.outerEnd), inner(other.inner) {}
+
+        reference operator*() const {
+            return *inner;
+        }
+
+        pointer operator->() const {
+            return &*inner;
+        }
+
+        Iterator& operator++() {
+            ++inner;
+            skipEmptyShards();
+            return *this;
+        }
+
+        bool operator==(const Iterator& other) const {
+            return outer == other.outer && (outer == outerEnd || inner == other.inner);
+        }
+
+        bool operator!=(const Iterator& other) const {
+            return !(*this == other);
+        }
+    };
+
+public:
+    using iterator = Iterator<false>;
+    using const_iterator = Iterator<true>;
+
+    static int regionOf(int id) {
+        return id > 0 ? (id - 1) / REGION_ID_RANGE : 0;
+    }
+
+    static int firstIdOf(int region) {
+        return region * REGION_ID_RANGE + 1;
+    }
+
+    static int lastIdOf(int region) {
+        return (region + 1) * REGION_ID_RANGE;
+    }
+
+    static int shardOf(int id) {
+        return regionOf(id) * SHARD_COUNT + (id % SHARD_COUNT + SHARD_COUNT) % SHARD_COUNT;
+    }
+
+    iterator begin() {
+        return shards.empty() ? end() : iterator(shards.begin(), shards.end(), shards.begin()->second.begin());
+    }
+
+    iterator end() {
+        return iterator(shards.end(), shards.end(), {});
+    }
+
+    const_iterator begin() const {
+        return shards.empty() ? end() : const_iterator(shards.begin(), shards.end(), shards.begin()->second.begin());
+    }
+
+    const_iterator end() const {
+        return const_iterator(shards.end(), shards.end(), {});
+    }
+
+    iterator find(int id) {
+        auto outer = shards.find(shardOf(id));
+        if (outer == shards.end()) {
+            return end();
+        }
+        auto inner = outer->second.find(id);
+        return inner == outer->second.end() ? end() : iterator(outer, shards.end(), inner);
+    }
+
+    const_iterator find(int id) const {
+        auto outer = shards.find(shardOf(id));
+        if (outer == shards.end()) {
+            return end();
+        }
+        auto inner = outer->second.find(id);
+        return inner == outer->second.end() ? end() : const_iterator(outer, shards.end(), inner);
+    }
+
+    T& operator[](int id) {
+        Shard& shard = shards[shardOf(id)];
+        size_t before = shard.size();
+        T& value = shard[id];
+        recordCount += shard.size() - before;
+        return value;
+    }
+
+    T& at(int id) {
+        return shards.at(shardOf(id)).at(id);
+    }
+
+    void erase(iterator it) {
+        it.outer->second.erase(it.inner);
+        recordCount--;
+    }
+
+    size_t erase(int id) {
+        auto it = find(id);
+        if (it == end()) {
+            return 0;
+        }
+        erase(it);
+        return 1;
+    }
+
+    size_t size() const {
+        return recordCount;
+    }
+
+    bool empty() const {
+        return recordCount == 0;
+    }
+
+    void clear() {
+        shards.clear();
+        recordCount = 0;
+    }
+
+    vector<int> shardIndexes() const {
+        vector<int> indexes;
+        for (const auto& pair : shards) {
+            indexes.push_back(pair.first);
+        }
+        return indexes;
+    }
+
+    Shard& shard(int index) {
+        return shards[index];
+    }
+
+    const Shard* findShard(int index) const {
+        auto it = shards.find(index);
+        return it == shards.end() ? nullptr : &it->second;
+    }
+
+    // Moves records read from one shard file into place. Files saved with an
+    // earlier shard layout are split up record by record.
+    void adopt(Shard&& records) {
+        if (records.empty()) {
+            return;
+        }
+        int index = shardOf(records.begin()->first);
+        bool sameShard = all_of(records.begin(), records.end(), [index](const typename Shard::value_type& pair) {
+            return shardOf(pair.first) == index;
+        });
+        Shard& target = shards[index];
+        if (sameShard && target.empty()) {
+            recordCount += records.size();
+            target = move(records);
+            return;
+        }
+        for (auto& pair : records) {
+            (*this)[pair.first] = move(pair.second);
+        }
+    }
+
+    // Call after filling shards directly through shard().
+    void recount() {
+        recordCount = 0;
+        for (const auto& pair : shards) {
+            recordCount += pair.second.size();
+        }
+    }
+
+    template<typename Predicate>
+    vector<int> collectIds(Predicate matches) const {
+        vector<const Shard*> parts;
+        for (const auto& pair : shards) {
+            parts.push_back(&pair.second);
+        }
+
+        vector<vector<int>> found(parts.size());
+        parallelFor(parts.size(), [&](size_t index) {
+            for (const auto& pair : *parts[index]) {
+                if (matches(pair.second)) {
+                    found[index].push_back(pair.first);
+                }
+            }
+        });
+
+        vector<int> result;
+        for (const vector<int>& part : found) {
+            result.insert(result.end(), part.begin(), part.end());
+        }
+        return result;
+    }
+
+    map<int, size_t> regionSizes() const {
+        map<int, size_t> sizes;
+        for (const auto& pair : shards) {
+            sizes[pair.first / SHARD_COUNT] += pair.second.size();
+        }
+        return sizes;
+    }
+
+    map<int, vector<int>> groupByShard(const vector<int>& ids) const {
+        map<int, vector<int>> groups;
+        for (int id : ids) {
+            groups[shardOf(id)].push_back(id);
+        }
+        return groups;
+    }
+};
+
+using PipeMap = ShardedMap<Pipe>;
+using StationMap = ShardedMap<CompressorStation>;
+
+string toLower(const string& str) {
+    string result = str;
+    transform(result.begin(), result.end(), result.begin(), ::tolower);
+    return result;
+}
+
+// Column name for exports: "Repair status" becomes "repair_status".
+string columnName(const string& label) {
+    string result = toLower(label);
+    replace(result.begin(), result.end(), ' ', '_');
+    return result;
+}
+
+// Value after `label` in a display-format record line, searched in [from, to).
+string recordFieldValue(const string& line, const string& label, size_t from, size_t to) {
+    size_t start = line.find(label, from);
+    if (start == string::npos || start >= to) {
+        return "";
+    }
+    start += label.size();
+    size_t end = line.find(" | ", start);
+    if (end == string::npos || end > to) {
+        end = to;
+    }
+    return line.substr(start, end - start);
+}
+
+bool isValidCoordinate(double value) {
+    return isfinite(value) && fabs(value) <= SPATIAL_COORDINATE_LIMIT;
+}
+
+// Names are stored one record per line.
+bool isValidName(const string& name) {
+    return name.find_first_of("\r\n") == string::npos;
+}
+
+// Reads "x, y"; missing coordinates stay 0. A point that is not a number or
+// lies outside the spatial index range is dropped and reported as invalid.
+bool parsePoint(const string& text, double& x, double& y) {
+    size_t comma = text.find(',');
+    x = text.empty() ? 0.0 : strtod(text.c_str(), nullptr);
+    y = comma == string::npos ? 0.0 : strtod(text.c_str() + comma + 1, nullptr);
+    if (!isValidCoordinate(x) || !isValidCoordinate(y)) {
+        x = y = 0.0;
+        return false;
+    }
+    return true;
+}
+
+// Re-asks until the value is a number inside the spatial index range.
+double readCoordinate(istream& in, const char* prompt) {
+    double value;
+    while (true) {
+        cout << prompt;
+        if (in >> value && isValidCoordinate(value)) {
+            return value;
+        }
+        if (in.eof()) {
+            return 0.0;
+        }
+        in.clear();
+        in.ignore(numeric_limits<streamsize>::max(), '\n');
+        cout << "Invalid input! Please enter a number between " << -SPATIAL_COORDINATE_LIMIT << " and " << SPATIAL_COORDINATE_LIMIT << ".\n";
+    }
+}
+
+// One stored field of an entity. sinceVersion is the first columnar snapshot
+// version that contains the field, so older snapshots still decode. Indexed
+// fields answer equality lookups without scanning every record.
+template<typename Owner, typename Value>
+struct FieldDescriptor {
+    using ValueType = Value;
+
+    const char* label;
+    Value Owner::* member;
+    int sinceVersion;
+    bool indexed;
+};
+
+template<typename Owner, typename Value>
+constexpr FieldDescriptor<Owner, Value> describeField(const char* label, Value Owner::* member, int sinceVersion = 1) {
+    return { label, member, sinceVersion, false };
+}
+
+template<typename Owner, typename Value>
+constexpr FieldDescriptor<Owner, Value> describeIndexedField(const char* label, Value Owner::* member, int sinceVersion = 1) {
+    return { label, member, sinceVersion, true };
+}
+
+// Record IDs by value of one field.
+template<typename Value>
+class FieldIndex {
+private:
+    unordered_map<Value, unordered_set<int>> postings;
+
+public:
+    void add(const Value& value, int id) {
+        postings[value].insert(id);
+    }
+
+    void remove(const Value& value, int id) {
+        auto it = postings.find(value);
+        if (it != postings.end()) {
+            it->second.erase(id);
+            if (it->second.empty()) {
+                postings.erase(it);
+            }
+        }
+    }
+
+    vector<int> find(const Value& value) const {
+        auto it = postings.find(value);
+        if (it == postings.end()) {
+            return {};
+        }
+        vector<int> ids(it->second.begin(), it->second.end());
+        sort(ids.begin(), ids.end());
+        return ids;
+    }
+
+    void clear() {
+        postings.clear();
+    }
+};
+
+template<typename Fields>
+struct FieldIndexes;
+
+template<typename... Field>
+struct FieldIndexes<tuple<Field...>> {
+    using type = tuple<FieldIndex<typename Field::ValueType>...>;
+};
+
+// Names, file tags and fields of an entity type. Every entity has `id` and
+// `name`; `fields` lists everything stored besides the ID, in snapshot order.
+template<typename T>
+struct EntityTraits;
+
+template<>
+struct EntityTraits<Pipe> {
+    static constexpr const char* typeName = "Pipe";
+    static constexpr const char* singular = "pipe";
+    static constexpr const char* plural = "pipes";
+    static constexpr const char* title = "PIPES";
+    static constexpr const char* recordTag = "[PIPE]";
+    static constexpr const char* nextIdTag = "[NEXT_PIPE_ID]";
+    static constexpr const char* usedIdsTag = "[USED_PIPE_IDS]";
+    static constexpr const char* deletedTag = "[DELETED_PIPES]";
+    static constexpr const char* nameEnd = " | Length: ";
+
+    static constexpr auto fields = make_tuple(
+        describeField("Name", &Pipe::name),
+        describeField("Length", &Pipe::length),
+        describeIndexedField("Diameter", &Pipe::diameter),
+        describeIndexedField("Repair status", &Pipe::underRepair),
+        describeIndexedField("Start station", &Pipe::startStationId, 2),
+        describeIndexedField("End station", &Pipe::endStationId, 2),
+        describeField("Start X", &Pipe::startX, 3),
+        describeField("Start Y", &Pipe::startY, 3),
+        describeField("End X", &Pipe::endX, 3),
+        describeField("End Y", &Pipe::endY, 3),
+        describeField("Geometry known", &Pipe::geometryKnown, 5));
+
+    static void parseFields(const string& line, size_t from, Pipe& pipe) {
+        pipe.length = atoi(recordFieldValue(line, "Length: ", from, line.size()).c_str());
+        pipe.diameter = atoi(recordFieldValue(line, "Diameter: ", from, line.size()).c_str());
+        pipe.underRepair = recordFieldValue(line, "Under repair: ", from, line.size()) == "Yes";
+        string route = recordFieldValue(line, "Route: ", from, line.size());
+        size_t arrow = route.find(" -> ");
+        pipe.startStationId = route.empty() ? 0 : atoi(route.c_str());
+        pipe.endStationId = arrow == string::npos ? 0 : atoi(route.c_str() + arrow + 4);
+        string geometry = recordFieldValue(line, "Geometry: ", from, line.size());
+        arrow = geometry.find(" -> ");
+        bool startValid = parsePoint(geometry.substr(0, arrow), pipe.startX, pipe.startY);
+        bool endValid = parsePoint(arrow == string::npos ? "" : geometry.substr(arrow + 4), pipe.endX, pipe.endY);
+        pipe.geometryKnown = arrow != string::npos && startValid && endValid;
+        if (!pipe.geometryKnown) {
+            pipe.startX = pipe.startY = pipe.endX = pipe.endY = 0.0;
+        }
+    }
+
+    // Limits that records entered interactively satisfy; imports are checked against them.
+    static bool isValid(const Pipe& pipe) {
+        return isValidName(pipe.name) && pipe.length > 0 && pipe.diameter > 0
+            && pipe.startStationId >= 0 && pipe.endStationId >= 0
+            && isValidCoordinate(pipe.startX) && isValidCoordinate(pipe.startY)
+            && isValidCoordinate(pipe.endX) && isValidCoordinate(pipe.endY);
+    }
+
+    // Before version 5 a pipe with all endpoints at 0, 0 had no geometry.
+    static void upgradeRecord(Pipe& pipe, int version) {
+        if (version < 5) {
+            pipe.geometryKnown = pipe.startX != 0.0 || pipe.startY != 0.0 || pipe.endX != 0.0 || pipe.endY != 0.0;
+        }
+    }
+};
+
+template<>
+struct EntityTraits<CompressorStation> {
+    static constexpr const char* typeName = "Station";
+    static constexpr const char* singular = "station";
+    static constexpr const char* plural = "stations";
+    static constexpr const char* title = "COMPRESSOR STATIONS";
+    static constexpr const char* recordTag = "[STATION]";
+    static constexpr const char* nextIdTag = "[NEXT_STATION_ID]";
+    static constexpr const char* usedIdsTag = "[USED_STATION_IDS]";
+    static constexpr const char* deletedTag = "[DELETED_STATIONS]";
+    static constexpr const char* nameEnd = " | Workshops: ";
+
+    static constexpr auto fields = make_tuple(
+        describeField("Name", &CompressorStation::name),
+        describeField("Total workshops", &CompressorStation::totalWorkshops),
+        describeField("Active workshops", &CompressorStation::activeWorkshops),
+        describeIndexedField("Class", &CompressorStation::stationClass),
+        describeField("Location X", &CompressorStation::x, 3),
+        describeField("Location Y", &CompressorStation::y, 3),
+        describeField("Location known", &CompressorStation::locationKnown, 4));
+
+    static void parseFields(const string& line, size_t from, CompressorStation& station) {
+        string workshops = recordFieldValue(line, "Workshops: ", from, line.size());
+        size_t slash = workshops.find('/');
+        station.activeWorkshops = (unsigned int)strtoul(workshops.c_str(), nullptr, 10);
+        station.totalWorkshops = slash == string::npos ? 0 : (unsigned int)strtoul(workshops.c_str() + slash + 1, nullptr, 10);
+        station.stationClass = atoi(recordFieldValue(line, "Class: ", from, line.size()).c_str());
+        string location = recordFieldValue(line, "Location: ", from, line.size());
+        station.locationKnown = parsePoint(location, station.x, station.y) && !location.empty();
+    }
+
+    static bool isValid(const CompressorStation& station) {
+        return isValidName(station.name) && station.activeWorkshops <= station.totalWorkshops
+            && isValidCoordinate(station.x) && isValidCoordinate(station.y);
+    }
+
+    // Before version 4 a station at 0, 0 had no location.
+    static void upgradeRecord(CompressorStation& station, int version) {
+        if (version < 4) {
+            station.locationKnown = station.x != 0.0 || station.y != 0.0;
+        }
+    }
+};
+
+template<typename T, typename Visitor>
+void forEachField(Visitor&& visit) {
+    apply([&visit](const auto&... field) { (visit(field), ...); }, EntityTraits<T>::fields);
+}
+
+template<typename T, typename Visitor>
+void visitField(size_t index, Visitor&& visit) {
+    size_t current = 0;
+    forEachField<T>([&](const auto& field) {
+        if (current++ == index) {
+            visit(field);
+        }
+    });
+}
+
+// Records of one entity type with their ID allocation and unsaved changes.
+// The columnar snapshot codec, sorting, searching and the indexes behind
+// findEqual are generated from EntityTraits<T>::fields. Text records are not:
+// each type's traits parse its line in parseFields, and its operator<< writes it.
+template<typename T>
+class EntityStore : public ShardedMap<T> {
+public:
+    using Traits = EntityTraits<T>;
+    using Shard = typename ShardedMap<T>::Shard;
+
+    static constexpr size_t sortFieldCount = tuple_size_v<decltype(Traits::fields)> + 1;
+
+    unordered_set<int> usedIds;
+    int nextId = 1;
+    // Next ID to try in each region after the first; region 0 uses nextId, so
+    // files written before regions existed read unchanged.
+    map<int, int> regionNextIds;
+    unordered_set<int> dirtyIds;
+    unordered_set<int> deletedIds;
+
+private:
+    using Indexes = typename FieldIndexes<remove_const_t<decltype(Traits::fields)>>::type;
+
+    // Built on the first lookup and then kept up to date by trackChange, so
+    // records filled in directly (loads, temporary views) never see a stale index.
+    mutable Indexes indexes;
+    mutable bool indexesBuilt = false;
+
+    template<typename Visitor, size_t... Index>
+    static void visitIndexes(Indexes& indexes, Visitor&& visit, index_sequence<Index...>) {
+        ((get<Index>(Traits::fields).indexed ? visit(get<Index>(Traits::fields), get<Index>(indexes)) : void()), ...);
+    }
+
+    template<typename Visitor>
+    static void visitIndexes(Indexes& indexes, Visitor&& visit) {
+        visitIndexes(indexes, visit, make_index_sequence<tuple_size_v<Indexes>>());
+    }
+
+    static void indexRecord(Indexes& indexes, const T& record) {
+        visitIndexes(indexes, [&record](const auto& field, auto& index) {
+            index.add(record.*field.member, record.id);
+        });
+    }
+
+    static void unindexRecord(Indexes& indexes, const T& record) {
+        visitIndexes(indexes, [&record](const auto& field, auto& index) {
+            index.remove(record.*field.member, record.id);
+        });
+    }
+
+    void buildIndexes() const {
+        visitIndexes(indexes, [](const auto&, auto& index) {
+            index.clear();
+        });
+        for (const auto& pair : *this) {
+            indexRecord(indexes, pair.second);
+        }
+        indexesBuilt = true;
+    }
+
+    static void writeIds(ostream& out, const unordered_set<int>& ids) {
+        for (int id : ids) {
+            out << id << " ";
+        }
+        out << "\n";
+    }
+
+    template<typename Key>
+    static void sortRecords(vector<const T*>& records, Key key, bool descending) {
+        auto less = [&key](const T* a, const T* b) {
+            if (key(a) != key(b)) return key(a) < key(b);
+            return a->id < b->id;
+        };
+
+        if (descending) {
+            sort(records.begin(), records.end(), [&less](const T* a, const T* b) { return less(b, a); });
+        } else {
+            sort(records.begin(), records.end(), less);
+        }
+    }
+
+    vector<const T*> recordsById() const {
+        vector<const T*> records;
+        records.reserve(this->size());
+        for (const auto& pair : *this) {
+            records.push_back(&pair.second);
+        }
+        sort(records.begin(), records.end(), [](const T* a, const T* b) { return a->id < b->id; });
+        return records;
+    }
+
+    static vector<ArrowField> arrowSchema() {
+        vector<ArrowField> schema = { arrowFieldOf<int>("id") };
+        forEachField<T>([&](const auto& field) {
+            using Value = typename decay_t<decltype(field)>::ValueType;
+            schema.push_back(arrowFieldOf<Value>(columnName(field.label)));
+        });
+        return schema;
+    }
+
+    // Column 0 is the ID, the rest follow Traits::fields.
+    static void fillArrowColumn(const T* const* records, size_t count, size_t column, ArrowColumn& out) {
+        if (column == 0) {
+            out.values.resize(4 * count);
+            for (size_t i = 0; i < count; i++) {
+                storeLittleEndian(out.values.data() + 4 * i, records[i]->id);
+            }
+            return;
+        }
+        visitField<T>(column - 1, [&](const auto& field) {
+            using Value = typename decay_t<decltype(field)>::ValueType;
+            if constexpr (is_same_v<Value, string>) {
+                out.offsets.resize(4 * (count + 1));
+                storeLittleEndian(out.offsets.data(), uint32_t(0));
+                for (size_t i = 0; i < count; i++) {
+                    const string& text = records[i]->*field.member;
+                    out.values.insert(out.values.end(), text.begin(), text.end());
+                    storeLittleEndian(out.offsets.data() + 4 * (i + 1), static_cast<uint32_t>(out.values.size()));
+                }
+            } else if constexpr (is_same_v<Value, bool>) {
+                out.values.assign((count + 7) / 8, 0);
+                for (size_t i = 0; i < count; i++) {
+                    if (records[i]->*field.member) {
+                        out.values[i / 8] |= static_cast<uint8_t>(1 << (i % 8));
+                    }
+                }
+            } else {
+                out.values.resize(sizeof(Value) * count);
+                for (size_t i = 0; i < count; i++) {
+                    storeLittleEndian(out.values.data() + sizeof(Value) * i, records[i]->*field.member);
+                }
+            }
+        });
+    }
+
+    // False if a value does not fit its field. IDs stay below INT_MAX so
+    // the next ID can still be allocated.
+    static bool readArrowColumn(const ArrowColumnView& column, size_t field, T* records) {
+        if (field == 0) {
+            for (size_t row = 0; row < column.length; row++) {
+                int64_t id;
+                if (column.isNull(row) || !column.integer(row, id) || id < 1 || id >= INT_MAX) {
+                    return false;
+                }
+                records[row].id = static_cast<int>(id);
+            }
+            return true;
+        }
+
+        bool valid = true;
+        visitField<T>(field - 1, [&](const auto& descriptor) {
+            using Value = typename decay_t<decltype(descriptor)>::ValueType;
+            for (size_t row = 0; row < column.length && valid; row++) {
+                if (column.isNull(row)) {
+                    continue;
+                }
+                Value& value = records[row].*descriptor.member;
+                if constexpr (is_same_v<Value, string>) {
+                    value = column.text(row);
+                } else if constexpr (is_floating_point_v<Value>) {
+                    double number = column.real(row);
+                    valid = isfinite(number) && fabs(number) <= numeric_limits<Value>::max();
+                    value = valid ? static_cast<Value>(number) : Value();
+                } else {
+                    int64_t number = 0;
+                    valid = column.integer(row, number) && number >= static_cast<int64_t>(numeric_limits<Value>::min())
+                        && number <= static_cast<int64_t>(numeric_limits<Value>::max());
+                    value = valid ? static_cast<Value>(number) : Value();
+                }
+            }
+        });
+        return valid;
+    }
+
+public:
+    int& nextIdOf(int region) {
+        return region == 0 ? nextId : regionNextIds[region];
+    }
+
+    // Returns 0 when the region has no free IDs left.
+    int generateId(int region = 0) {
+        int& next = nextIdOf(region);
+        next = max(next, this->firstIdOf(region));
+        while (next <= this->lastIdOf(region) && usedIds.find(next) != usedIds.end()) {
+            next++;
+        }
+        if (next > this->lastIdOf(region)) {
+            return 0;
+        }
+        int newId = next;
+        usedIds.insert(newId);
+        next++;
+        return newId;
+    }
+
+    // Marks an ID assigned elsewhere as taken in its region.
+    void noteUsedId(int id) {
+        usedIds.insert(id);
+        int& next = nextIdOf(this->regionOf(id));
+        next = max(next, id < this->lastIdOf(this->regionOf(id)) ? id + 1 : id);
+    }
+
+    void releaseId(int id) {
+        usedIds.erase(id);
+    }
+
+    void trackChange(const T* before, const T* after) {
+        if (indexesBuilt) {
+            if (before != nullptr) {
+                unindexRecord(indexes, *before);
+            }
+            if (after != nullptr) {
+                indexRecord(indexes, *after);
+            }
+        }
+        if (after != nullptr) {
+            dirtyIds.insert(after->id);
+            deletedIds.erase(after->id);
+        } else {
+            dirtyIds.erase(before->id);
+            deletedIds.insert(before->id);
+        }
+    }
+
+    void clearChanges() {
+        dirtyIds.clear();
+        deletedIds.clear();
+    }
+
+    bool hasChanges() const {
+        return !dirtyIds.empty() || !deletedIds.empty();
+    }
+
+    void reset() {
+        this->clear();
+        usedIds.clear();
+        regionNextIds.clear();
+        clearChanges();
+        invalidateIndexes();
+    }
+
+    // Call after records were replaced without trackChange.
+    void invalidateIndexes() {
+        indexesBuilt = false;
+    }
+
+    vector<int> allIds() const {
+        vector<int> ids;
+        ids.reserve(this->size());
+        for (const auto& pair : *this) {
+            ids.push_back(pair.first);
+        }
+        return ids;
+    }
+
+    vector<int> findByName(const string& searchName) const {
+        string searchNameLower = toLower(searchName);
+        return this->collectIds([&searchNameLower](const T& record) {
+            return toLower(record.name).find(searchNameLower) != string::npos;
+        });
+    }
+
+    // Uses the field's index when it has one.
+    template<typename Value>
+    vector<int> findEqual(Value T::* member, const Value& value) const {
+        optional<vector<int>> found;
+        visitIndexes(indexes, [&](const auto& field, const auto& index) {
+            if constexpr (is_same_v<typename decay_t<decltype(field)>::ValueType, Value>) {
+                if (field.member == member) {
+                    if (!indexesBuilt) {
+                        buildIndexes();
+                    }
+                    found = index.find(value);
+                }
+            }
+        });
+        if (found) {
+            return move(*found);
+        }
+        return this->collectIds([member, &value](const T& record) {
+            return record.*member == value;
+        });
+    }
+
+    static string sortFieldMenu() {
+        string menu = "1. ID\n";
+        size_t number = 2;
+        forEachField<T>([&](const auto& field) {
+            menu += to_string(number++) + ". " + field.label + "\n";
+        });
+        return menu;
+    }
+
+    // Field 0 is the ID, the rest follow Traits::fields.
+    vector<const T*> sortedBy(const vector<int>& ids, size_t field, bool descending) const {
+        vector<const T*> sorted;
+        sorted.reserve(ids.size());
+        for (int id : ids) {
+            auto it = this->find(id);
+            if (it != this->end()) {
+                sorted.push_back(&it->second);
+            }
+        }
+
+        if (field == 0) {
+            sortRecords(sorted, [](const T* record) { return record->id; }, descending);
+        } else {
+            visitField<T>(field - 1, [&](const auto& descriptor) {
+                auto member = descriptor.member;
+                sortRecords(sorted, [member](const T* record) -> const auto& { return record->*member; }, descending);
+            });
+        }
+        return sorted;
+    }
+
+    static bool parse(const string& line, T& record) {
+        size_t nameStart = line.find(" | Name: ");
+        size_t nameEnd = line.rfind(Traits::nameEnd);
+        if (line.compare(0, 4, "ID: ") != 0 || nameStart == string::npos || nameEnd == string::npos || nameEnd < nameStart) {
+            return false;
+        }
+
+        record.id = atoi(line.c_str() + 4);
+        record.name = line.substr(nameStart + 9, nameEnd - nameStart - 9);
+        Traits::parseFields(line, nameEnd, record);
+        return true;
+    }
+
+    void writeNextIds(ostream& out) const {
+        out << Traits::nextIdTag << "\n" << nextId;
+        for (const auto& pair : regionNextIds) {
+            out << " " << pair.first << ":" << pair.second;
+        }
+        out << "\n";
+    }
+
+    static void writeRecord(ostream& out, const T& record) {
+        out << Traits::recordTag << "\n";
+        out << record;
+    }
+
+    void writeIdHeader(ostream& out) const {
+        writeNextIds(out);
+        out << Traits::usedIdsTag << "\n";
+        writeIds(out, usedIds);
+    }
+
+    void writeShard(ostream& out, int index) const {
+        if (const Shard* shard = this->findShard(index)) {
+            for (const auto& pair : *shard) {
+                writeRecord(out, pair.second);
+            }
+        }
+    }
+
+    void writeChanges(ostream& out) const {
+        writeNextIds(out);
+        for (int id : dirtyIds) {
+            writeRecord(out, this->find(id)->second);
+        }
+        out << Traits::deletedTag << "\n";
+        writeIds(out, deletedIds);
+    }
+
+    // Reads the section started by `tag`; returns false if it belongs to another type.
+    bool readSection(const string& tag, istream& in) {
+        string line;
+        if (tag == Traits::recordTag) {
+            T record;
+            getline(in, line);
+            if (parse(line, record)) {
+                usedIds.insert(record.id);
+                (*this)[record.id] = move(record);
+            }
+        }
+        else if (tag == Traits::nextIdTag) {
+            getline(in, line);
+            stringstream ss(line);
+            ss >> nextId;
+            int region, next;
+            char colon;
+            while (ss >> region >> colon >> next) {
+                if (region > 0 && region < REGION_COUNT) {
+                    regionNextIds[region] = next;
+                }
+            }
+        }
+        else if (tag == Traits::usedIdsTag || tag == Traits::deletedTag) {
+            getline(in, line);
+            stringstream ss(line);
+            int id;
+            while (ss >> id) {
+                if (tag == Traits::usedIdsTag) {
+                    usedIds.insert(id);
+                } else {
+                    this->erase(id);
+                    releaseId(id);
+                }
+            }
+        }
+        else {
+            return false;
+        }
+        return true;
+    }
+
+    static bool readShardRecord(const string& tag, istream& in, Shard& shard) {
+        if (tag != Traits::recordTag) {
+            return false;
+        }
+        T record;
+        string line;
+        getline(in, line);
+        if (parse(line, record)) {
+            shard[record.id] = move(record);
+        }
+        return true;
+    }
+
+    // IDs as sorted deltas, then one column per field: dictionary-coded strings,
+    // bit-packed flags, raw doubles and frame-of-reference integers.
+    void encodeColumns(ByteWriter& writer) const {
+        vector<const T*> records = recordsById();
+
+        vector<int> ids;
+        ids.reserve(records.size());
+        for (const T* record : records) {
+            ids.push_back(record->id);
+        }
+        writer.putSortedIds(ids);
+
+        forEachField<T>([&](const auto& field) {
+            using Value = typename decay_t<decltype(field)>::ValueType;
+            if constexpr (is_same_v<Value, string>) {
+                vector<const string*> column;
+                for (const T* record : records) {
+                    column.push_back(&(record->*field.member));
+                }
+                writer.putDictionary(column);
+            } else if constexpr (is_same_v<Value, bool>) {
+                vector<uint64_t> column;
+                for (const T* record : records) {
+                    column.push_back(record->*field.member ? 1 : 0);
+                }
+                writer.putBitPacked(column, 1);
+            } else if constexpr (is_floating_point_v<Value>) {
+                vector<double> column;
+                for (const T* record : records) {
+                    column.push_back(record->*field.member);
+                }
+                writer.putDoubles(column);
+            } else {
+                vector<int64_t> column;
+                for (const T* record : records) {
+                    column.push_back(static_cast<int64_t>(record->*field.member));
+                }
+                writer.putFrameOfReference(column);
+            }
+        });
+    }
+
+    static bool decodeColumns(ByteReader& reader, int version, vector<T>& records) {
+        vector<int> ids;
+        if (!reader.getSortedIds(ids)) {
+            return false;
+        }
+        records.assign(ids.size(), T());
+        for (size_t i = 0; i < ids.size(); i++) {
+            records[i].id = ids[i];
+        }
+
+        bool complete = true;
+        forEachField<T>([&](const auto& field) {
+            using Value = typename decay_t<decltype(field)>::ValueType;
+            if (!complete || version < field.sinceVersion) {
+                return;
+            }
+            if constexpr (is_same_v<Value, string>) {
+                vector<string> column;
+                complete = reader.getDictionary(column, ids.size());
+                for (size_t i = 0; complete && i < ids.size(); i++) {
+                    records[i].*field.member = move(column[i]);
+                }
+            } else if constexpr (is_same_v<Value, bool>) {
+                vector<uint64_t> column;
+                complete = reader.getBitPacked(column, ids.size());
+                for (size_t i = 0; complete && i < ids.size(); i++) {
+                    records[i].*field.member = column[i] != 0;
+                }
+            } else if constexpr (is_floating_point_v<Value>) {
+                vector<double> column;
+                complete = reader.getDoubles(column, ids.size());
+                for (size_t i = 0; complete && i < ids.size(); i++) {
+                    records[i].*field.member = column[i];
+                }
+            } else {
+                vector<int64_t> column;
+                complete = reader.getFrameOfReference(column, ids.size());
+                for (size_t i = 0; complete && i < ids.size(); i++) {
+                    records[i].*field.member = static_cast<Value>(column[i]);
+                }
+            }
+        });
+        for (T& record : records) {
+            Traits::upgradeRecord(record, version);
+        }
+        return complete && reader.ok();
+    }
+
+    // Arrow IPC file with an id column and one column per field, in ID order.
+    void writeArrow(ostream& out) const {
+        vector<const T*> records = recordsById();
+        vector<ArrowField> schema = arrowSchema();
+        ArrowFileWriter writer(out, schema);
+        for (size_t first = 0; first < records.size(); first += ARROW_BATCH_ROWS) {
+            size_t count = min(ARROW_BATCH_ROWS, records.size() - first);
+            vector<ArrowColumn> columns(schema.size());
+            parallelFor(columns.size(), [&](size_t i) {
+                fillArrowColumn(records.data() + first, count, i, columns[i]);
+            });
+            writer.writeBatch(count, columns);
+        }
+        writer.finish();
+    }
+
+    // Columns are matched by name; missing columns and null values keep the
+    // defaults. Numeric columns of any width convert to the field type. A file
+    // without a column reads like a snapshot from before the column was added.
+    static bool readArrow(const vector<uint8_t>& bytes, vector<T>& records) {
+        ArrowFileReader reader(bytes.data(), bytes.size());
+        if (!reader.open()) {
+            return false;
+        }
+
+        vector<ArrowField> schema = arrowSchema();
+        vector<int> sources(schema.size());
+        int version = SNAPSHOT_MAGIC[3] - '0';
+        for (size_t i = 0; i < schema.size(); i++) {
+            sources[i] = reader.findColumn(schema[i].name);
+            if (sources[i] >= 0 && (reader.schema()[sources[i]].type == ArrowType::Utf8) != (schema[i].type == ArrowType::Utf8)) {
+                return false;
+            }
+            if (sources[i] < 0 && i > 0) {
+                visitField<T>(i - 1, [&](const auto& field) {
+                    version = min(version, field.sinceVersion - 1);
+                });
+            }
+        }
+        if (sources[0] < 0 || reader.schema()[sources[0]].type == ArrowType::Utf8) {
+            return false;
+        }
+
+        for (size_t batch = 0; batch < reader.batchCount(); batch++) {
+            vector<ArrowColumnView> columns;
+            if (!reader.readBatch(batch, columns)) {
+                return false;
+            }
+            size_t first = records.size();
+            records.resize(first + columns[0].length);
+            vector<char> valid(schema.size(), 1);
+            parallelFor(schema.size(), [&](size_t i) {
+                if (sources[i] >= 0) {
+                    valid[i] = readArrowColumn(columns[sources[i]], i, records.data() + first);
+                }
+            });
+            if (find(valid.begin(), valid.end(), 0) != valid.end()) {
+                return false;
+            }
+        }
+        for (T& record : records) {
+            Traits::upgradeRecord(record, version);
+        }
+        return true;
+    }
+};
+
+enum class EventKind : uint8_t { Workshops = 1, RepairStatus = 2 };
+
+// Fixed-size record shared by the in-memory log and the .events file.
+struct HistoryEvent {
+    int64_t timestamp = 0;
+    int32_t objectId = 0;
+    uint32_t value = 0;
+    uint32_t totalWorkshops = 0;
+    int16_t stationClass = 0;
+    EventKind kind = EventKind::Workshops;
+    uint8_t reserved = 0;
+};
+static_assert(sizeof(HistoryEvent) == 24, "HistoryEvent is stored on disk as is");
+
+struct Rollup {
+    long long count = 0;
+    double sum = 0.0;
+    double minValue = 0.0;
+    double maxValue = 0.0;
+
+    void add(double value) {
+        minValue = count == 0 ? value : min(minValue, value);
+        maxValue = count == 0 ? value : max(maxValue, value);
+        sum += value;
+        count++;
+    }
+
+    void merge(const Rollup& other) {
+        if (other.count == 0) {
+            return;
+        }
+        minValue = count == 0 ? other.minValue : min(minValue, other.minValue);
+        maxValue = count == 0 ? other.maxValue : max(maxValue, other.maxValue);
+        sum += other.sum;
+        count += other.count;
+    }
+};
+
+// Append-only log of workshop and repair-status changes with per-minute,
+// per-hour and per-day rollups of the recorded values. Utilization is also
+// kept as a step function per station class, so its average over a period
+// can weight each value by how long it was held.
+class EventHistory {
+public:
+    static const int ALL_GROUPS = INT_MIN;
+
+private:
+    static constexpr int64_t BUCKET_SECONDS[3] = { 60, 3600, 86400 };
+
+    struct BucketKey {
+        int64_t bucket;
+        int group;
+
+        bool operator==(const BucketKey& other) const {
+            return bucket == other.bucket && group == other.group;
+        }
+    };
+
+    struct BucketKeyHash {
+        size_t operator()(const BucketKey& key) const {
+            return hash<int64_t>()(key.bucket * 1000003 + key.group);
+        }
+    };
+
+    using RollupMap = unordered_map<BucketKey, Rollup, BucketKeyHash>;
+
+    // From `time` on, the stations of a group hold `held` percent in total;
+    // the integrals run up to `time`.
+    struct UtilizationStep {
+        int64_t time;
+        double held;
+        double stations;
+        double heldIntegral;
+        double stationIntegral;
+    };
+
+    struct HeldUtilization {
+        double value;
+        int group;
+    };
+
+    vector<HistoryEvent> events;
+    RollupMap rollups[2][3];
+    unordered_map<int, vector<UtilizationStep>> utilizationSteps;
+    unordered_map<int, HeldUtilization> heldUtilization;
+    size_t persistedEvents = 0;
+    string persistedName = "";
+
+    static double eventValue(const HistoryEvent& event) {
+        if (event.kind == EventKind::RepairStatus) {
+            return event.value;
+        }
+        return event.totalWorkshops > 0 ? (double)event.value / event.totalWorkshops * 100.0 : 0.0;
+    }
+
+    void addToRollups(const HistoryEvent& event) {
+        RollupMap* levels = rollups[event.kind == EventKind::Workshops ? 0 : 1];
+        double value = eventValue(event);
+        for (int level = 0; level < 3; level++) {
+            int64_t bucket = event.timestamp / BUCKET_SECONDS[level];
+            levels[level][{ bucket, event.stationClass }].add(value);
+            if (event.kind == EventKind::Workshops) {
+                levels[level][{ bucket, ALL_GROUPS }].add(value);
+            }
+        }
+        if (event.kind == EventKind::Workshops) {
+            holdUtilization(event.objectId, event.stationClass, event.timestamp, value);
+        }
+    }
+
+    // Events arrive in time order; one that is late counts from the last step.
+    void changeHeld(int group, int64_t time, double heldChange, double stationChange) {
+        vector<UtilizationStep>& steps = utilizationSteps[group];
+        if (steps.empty()) {
+            steps.push_back({ time, heldChange, stationChange, 0.0, 0.0 });
+            return;
+        }
+
+        const UtilizationStep& last = steps.back();
+        time = max(time, last.time);
+        double elapsed = static_cast<double>(time - last.time);
+        UtilizationStep step = { time, last.held + heldChange, last.stations + stationChange,
+            last.heldIntegral + last.held * elapsed, last.stationIntegral + last.stations * elapsed };
+        if (time == last.time) {
+            steps.back() = step;
+        } else {
+            steps.push_back(step);
+        }
+    }
+
+    void holdUtilization(int stationId, int group, int64_t time, double value) {
+        auto previous = heldUtilization.find(stationId);
+        if (previous != heldUtilization.end()) {
+            changeHeld(previous->second.group, time, -previous->second.value, -1.0);
+            changeHeld(ALL_GROUPS, time, -previous->second.value, -1.0);
+        }
+        changeHeld(group, time, value, 1.0);
+        changeHeld(ALL_GROUPS, time, value, 1.0);
+        heldUtilization[stationId] = { value, group };
+    }
+
+    // Integrals of the held total and of the station count up to `time`.
+    static pair<double, double> integralsAt(const vector<UtilizationStep>& steps, int64_t time) {
+        auto it = upper_bound(steps.begin(), steps.end(), time,
+            [](int64_t value, const UtilizationStep& step) { return value < step.time; });
+        if (it == steps.begin()) {
+            return { 0.0, 0.0 };
+        }
+        const UtilizationStep& step = *prev(it);
+        double elapsed = static_cast<double>(time - step.time);
+        return { step.heldIntegral + step.held * elapsed, step.stationIntegral + step.stations * elapsed };
+    }
+
+public:
+    static int64_t now() {
+        return chrono::duration_cast<chrono::seconds>(chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    const vector<HistoryEvent>& all() const {
+        return events;
+    }
+
+    void recordWorkshops(const CompressorStation& station, int64_t timestamp = now()) {
+        HistoryEvent event;
+        event.timestamp = timestamp;
+        event.objectId = station.id;
+        event.value = station.activeWorkshops;
+        event.totalWorkshops = station.totalWorkshops;
+        event.stationClass = static_cast<int16_t>(max(-32768, min(32767, station.stationClass)));
+        event.kind = EventKind::Workshops;
+        events.push_back(event);
+        addToRollups(event);
+    }
+
+    void recordRepairStatus(const Pipe& pipe, int64_t timestamp = now()) {
+        HistoryEvent event;
+        event.timestamp = timestamp;
+        event.objectId = pipe.id;
+        event.value = pipe.underRepair ? 1 : 0;
+        event.kind = EventKind::RepairStatus;
+        events.push_back(event);
+        addToRollups(event);
+    }
+
+    // Covers [from, to) with whole days where possible, then whole hours,
+    // then minutes, so a query touches at most a few hundred buckets.
+    Rollup query(EventKind kind, int group, int64_t from, int64_t to) const {
+        const RollupMap* levels = rollups[kind == EventKind::Workshops ? 0 : 1];
+        Rollup result;
+        int64_t time = from / BUCKET_SECONDS[0] * BUCKET_SECONDS[0];
+        while (time < to) {
+            int level = 2;
+            while (level > 0 && (time % BUCKET_SECONDS[level] != 0 || time + BUCKET_SECONDS[level] > to)) {
+                level--;
+            }
+            auto it = levels[level].find({ time / BUCKET_SECONDS[level], group });
+            if (it != levels[level].end()) {
+                result.merge(it->second);
+            }
+            time += BUCKET_SECONDS[level];
+        }
+        return result;
+    }
+
+    // Utilization over [from, to), each station's value weighted by how long
+    // it was held. False when no station of the group had a value then.
+    bool averageUtilization(int group, int64_t from, int64_t to, double& average) const {
+        auto it = utilizationSteps.find(group);
+        if (it == utilizationSteps.end()) {
+            return false;
+        }
+        pair<double, double> start = integralsAt(it->second, from);
+        pair<double, double> end = integralsAt(it->second, to);
+        double stationSeconds = end.second - start.second;
+        if (stationSeconds <= 0.0) {
+            return false;
+        }
+        average = (end.first - start.first) / stationSeconds;
+        return true;
+    }
+
+    bool save(const string& filename) {
+        bool append = filename == persistedName;
+        FileOutput outFile(filename + ".events", append);
+        if (!outFile) {
+            return false;
+        }
+
+        size_t first = append ? persistedEvents : 0;
+        outFile.write(reinterpret_cast<const char*>(events.data() + first), (events.size() - first) * sizeof(HistoryEvent));
+        outFile.close();
+        if (!outFile) {
+            return false;
+        }
+
+        persistedName = filename;
+        persistedEvents = events.size();
+        return true;
+    }
+
+    void load(const string& filename) {
+        events.clear();
+        for (auto& levels : rollups) {
+            for (auto& level : levels) {
+                level.clear();
+            }
+        }
+        utilizationSteps.clear();
+        heldUtilization.clear();
+
+        FileInput inFile(filename + ".events");
+        HistoryEvent event;
+        while (inFile.read(reinterpret_cast<char*>(&event), sizeof(HistoryEvent))) {
+            events.push_back(event);
+            addToRollups(event);
+        }
+        if (inFile.readFailed()) {
+            cout << "Warning: Could not read all of " << filename << ".events\n";
+        }
+
+        persistedName = filename;
+        persistedEvents = events.size();
+    }
+};
+
+template<typename T>
+struct UndoRecord {
+    uint64_t version = 0;
+    int id = 0;
+    bool existed = false;
+    T before;
+};
+
+// Read-only state of one entity type as of a past version: live records,
+// except those changed later, which come from their before-images.
+template<typename T>
+class PointInTimeView {
+private:
+    const ShardedMap<T>& live;
+    unordered_map<int, optional<T>> overlay;
+
+public:
+    PointInTimeView(const ShardedMap<T>& live, const deque<UndoRecord<T>>& undo, uint64_t version) : live(live) {
+        for (auto it = undo.rbegin(); it != undo.rend() && it->version > version; ++it) {
+            overlay[it->id] = it->existed ? optional<T>(it->before) : nullopt;
+        }
+    }
+
+    template<typename Visitor>
+    void forEach(Visitor visit) const {
+        for (const auto& pair : live) {
+            if (overlay.find(pair.first) == overlay.end()) {
+                visit(pair.second);
+            }
+        }
+        for (const auto& pair : overlay) {
+            if (pair.second) {
+                visit(*pair.second);
+            }
+        }
+    }
+
+    size_t changedRecords() const {
+        return overlay.size();
+    }
+};
+
+// Every change gets a version number and keeps the before-image of the
+// record. Old versions are dropped once more than `retention` are kept.
+class VersionLog {
+private:
+    deque<UndoRecord<Pipe>> pipeUndo;
+    deque<UndoRecord<CompressorStation>> stationUndo;
+    deque<pair<uint64_t, int64_t>> versionTimes;
+    uint64_t currentVersion = 0;
+    uint64_t oldestVersion = 0;
+    int64_t oldestTime = EventHistory::now();
+    size_t retention = DEFAULT_VERSION_RETENTION;
+
+    template<typename T>
+    uint64_t append(deque<UndoRecord<T>>& undo, const T* before, const T* after) {
+        UndoRecord<T> record;
+        record.version = ++currentVersion;
+        record.id = after != nullptr ? after->id : before->id;
+        record.existed = before != nullptr;
+        if (before != nullptr) {
+            record.before = *before;
+        }
+        undo.push_back(move(record));
+        versionTimes.emplace_back(currentVersion, EventHistory::now());
+        collectGarbage();
+        return currentVersion;
+    }
+
+public:
+    uint64_t current() const {
+        return currentVersion;
+    }
+
+    uint64_t oldest() const {
+        return oldestVersion;
+    }
+
+    // Earliest time whose state can still be rebuilt.
+    int64_t oldestTimestamp() const {
+        return oldestTime;
+    }
+
+    size_t retainedVersions() const {
+        return versionTimes.size();
+    }
+
+    void setRetention(size_t versions) {
+        retention = versions;
+        collectGarbage();
+    }
+
+    void recordPipe(const Pipe* before, const Pipe* after) {
+        append(pipeUndo, before, after);
+    }
+
+    void recordStation(const CompressorStation* before, const CompressorStation* after) {
+        append(stationUndo, before, after);
+    }
+
+    // A reload replaces everything, so earlier versions can no longer be rebuilt.
+    void reset() {
+        pipeUndo.clear();
+        stationUndo.clear();
+        versionTimes.clear();
+        oldestVersion = currentVersion;
+        oldestTime = EventHistory::now();
+    }
+
+    void collectGarbage() {
+        while (versionTimes.size() > retention) {
+            oldestVersion = versionTimes.front().first;
+            oldestTime = versionTimes.front().second;
+            versionTimes.pop_front();
+        }
+        while (!pipeUndo.empty() && pipeUndo.front().version <= oldestVersion) {
+            pipeUndo.pop_front();
+        }
+        while (!stationUndo.empty() && stationUndo.front().version <= oldestVersion) {
+            stationUndo.pop_front();
+        }
+    }
+
+    // Latest version committed at or before the given time.
+    uint64_t versionAt(int64_t timestamp) const {
+        auto it = upper_bound(versionTimes.begin(), versionTimes.end(), timestamp,
+            [](int64_t time, const pair<uint64_t, int64_t>& entry) { return time < entry.second; });
+        return it == versionTimes.begin() ? oldestVersion : prev(it)->first;
+    }
+
+    PointInTimeView<Pipe> pipesAsOf(const PipeMap& pipes, uint64_t version) const {
+        return PointInTimeView<Pipe>(pipes, pipeUndo, version);
+    }
+
+    PointInTimeView<CompressorStation> stationsAsOf(const StationMap& stations, uint64_t version) const {
+        return PointInTimeView<CompressorStation>(stations, stationUndo, version);
+    }
+};
+
+// Single-producer single-consumer queue: the producer only writes tail and
+// the consumer only writes head, so neither side ever takes a lock.
+template<typename T>
+class SpscRing {
+private:
+    vector<T> slots;
+    size_t mask;
+    alignas(64) atomic<size_t> head;
+    alignas(64) atomic<size_t> tail;
+
+public:
+    explicit SpscRing(size_t capacity) : slots(capacity), mask(capacity - 1), head(0), tail(0) {}
+
+    bool tryPush(T&& value) {
+        size_t position = tail.load(memory_order_relaxed);
+        if (position - head.load(memory_order_acquire) == slots.size()) {
+            return false;
+        }
+        slots[position & mask] = move(value);
+        tail.store(position + 1, memory_order_release);
+        return true;
+    }
+
+    // Called by the producer; the consumer may only make it smaller meanwhile.
+    size_t size() const {
+        return tail.load(memory_order_relaxed) - head.load(memory_order_acquire);
+    }
+
+    size_t capacity() const {
+        return slots.size();
+    }
+
+    bool tryPop(T& value) {
+        size_t position = head.load(memory_order_relaxed);
+        if (position == tail.load(memory_order_acquire)) {
+            return false;
+        }
+        value = move(slots[position & mask]);
+        head.store(position + 1, memory_order_release);
+        return true;
+    }
+};
+
+enum class ChangeOperation : uint8_t { Insert, Update, Delete, Reset };
+enum class EntityType : uint8_t { Pipe, Station };
+
+struct ChangeEvent {
+    uint64_t sequence = 0;
+    int64_t timestamp = 0;
+    ChangeOperation operation = ChangeOperation::Reset;
+    EntityType entity = EntityType::Pipe;
+    int id = 0;
+    Pipe pipe;
+    CompressorStation station;
+    // Set on the RESET that ends a lag: the sequence numbers left out and the
+    // records they changed.
+    uint64_t droppedFrom = 0;
+    uint64_t droppedTo = 0;
+    vector<int> droppedPipes;
+    vector<int> droppedStations;
+
+    friend OutputBuffer& operator<<(OutputBuffer& out, const ChangeEvent& event);
+};
+
+class ChangeSubscriber {
+public:
+    virtual ~ChangeSubscriber() = default;
+    virtual bool deliver(const ChangeEvent& event) = 0;
+    virtual void flush() {}
+};
+
+// Appends one line per event: "<sequence> <time> <operation> <entity> <id>",
+// followed by " | <record>" for inserts and updates. A RESET that ends a lag
+// is followed by " | Dropped: <first>-<last> | Pipes: <ids> | Stations: <ids>".
+class FileChangeSubscriber : public ChangeSubscriber {
+private:
+    FileOutput file;
+    OutputBuffer buffer;
+
+public:
+    explicit FileChangeSubscriber(const string& path) : file(path, true), buffer(file) {}
+
+    bool isOpen() const {
+        return file.isOpen();
+    }
+
+    bool deliver(const ChangeEvent& event) override {
+        buffer << event;
+        return true;
+    }
+
+    void flush() override {
+        buffer.flush();
+        file.flush();
+    }
+
+    static uint64_t lastSequence(const string& path) {
+        ifstream inFile(path, ios::ate);
+        if (!inFile) {
+            return 0;
+        }
+
+        streamoff size = inFile.tellg();
+        streamoff start = max<streamoff>(0, size - 65536);
+        inFile.seekg(start);
+        string line;
+        uint64_t sequence = 0;
+        if (start > 0) {
+            getline(inFile, line);
+        }
+        while (getline(inFile, line)) {
+            if (!line.empty()) {
+                sequence = strtoull(line.c_str(), nullptr, 10);
+            }
+        }
+        return sequence;
+    }
+};
+
+// Publishes changes from the edit path into a ring drained by a background
+// thread, which hands them to the subscriber in sequence order. While the ring
+// is full the edit path blocks until the consumer frees a slot, but for at most
+// CHANGE_FEED_MAX_WAIT_MS in total until the subscriber catches up to half the
+// ring. After that the feed is lagged: events are dropped until the ring is
+// half empty again, and then a RESET listing the dropped sequence numbers and
+// the records they changed tells the subscriber what to resynchronize.
+class ChangeFeed {
+private:
+    unique_ptr<SpscRing<ChangeEvent>> ring;
+    unique_ptr<ChangeSubscriber> subscriber;
+    thread consumer;
+    atomic<bool> running{ false };
+    uint64_t nextSequence = 1;
+    chrono::steady_clock::duration waited{};
+    bool lagged = false;
+    uint64_t dropped = 0;
+    ChangeEvent droppedChanges;
+    set<int> droppedPipes;
+    set<int> droppedStations;
+
+    mutex spaceLock;
+    condition_variable spaceFreed;
+    atomic<bool> producerWaiting{ false };
+
+    void drain() {
+        ChangeEvent event;
+        while (true) {
+            bool stopping = !running.load(memory_order_acquire);
+            bool delivered = false;
+            while (ring->tryPop(event)) {
+                if (producerWaiting.load()) {
+                    lock_guard<mutex> guard(spaceLock);
+                    spaceFreed.notify_one();
+                }
+                subscriber->deliver(event);
+                delivered = true;
+            }
+            if (delivered) {
+                subscriber->flush();
+            } else if (stopping) {
+                return;
+            } else {
+                this_thread::sleep_for(chrono::milliseconds(1));
+            }
+        }
+    }
+
+    // tryPush leaves the event in place when the ring is full, so it can be
+    // retried or recorded as dropped. The consumer checks producerWaiting after every pop, and the
+    // flag is set before the retry under the lock, so no wakeup is lost.
+    bool tryPublish(ChangeEvent&& event) {
+        event.sequence = nextSequence;
+        event.timestamp = EventHistory::now();
+        bool published = ring->tryPush(move(event));
+        if (!published) {
+            auto started = chrono::steady_clock::now();
+            auto deadline = started + chrono::milliseconds(CHANGE_FEED_MAX_WAIT_MS) - waited;
+            unique_lock<mutex> guard(spaceLock);
+            producerWaiting.store(true);
+            published = spaceFreed.wait_until(guard, deadline, [&] { return ring->tryPush(move(event)); });
+            producerWaiting.store(false);
+            waited += chrono::steady_clock::now() - started;
+        }
+        if (published) {
+            nextSequence++;
+        }
+        return published;
+    }
+
+    // A dropped event still uses up its sequence number, so readers see the gap.
+    void drop(const ChangeEvent& event) {
+        if (droppedChanges.droppedFrom == 0) {
+            droppedChanges.droppedFrom = nextSequence;
+        }
+        droppedChanges.droppedTo = nextSequence;
+        if (event.operation != ChangeOperation::Reset) {
+            (event.entity == EntityType::Pipe ? droppedPipes : droppedStations).insert(event.id);
+        }
+        nextSequence++;
+        dropped++;
+    }
+
+    bool publishDropped() {
+        droppedChanges.droppedPipes.assign(droppedPipes.begin(), droppedPipes.end());
+        droppedChanges.droppedStations.assign(droppedStations.begin(), droppedStations.end());
+        if (!tryPublish(move(droppedChanges))) {
+            return false;
+        }
+        droppedChanges = ChangeEvent();
+        droppedPipes.clear();
+        droppedStations.clear();
+        lagged = false;
+        return true;
+    }
+
+    void publish(ChangeEvent&& event) {
+        bool caughtUp = ring->size() <= ring->capacity() / 2;
+        if (caughtUp) {
+            waited = {};
+        }
+        if (lagged) {
+            if (!caughtUp) {
+                drop(event);
+                return;
+            }
+            publishDropped();
+        }
+        if (!tryPublish(move(event))) {
+            drop(event);
+            lagged = true;
+        }
+    }
+
+public:
+    ~ChangeFeed() {
+        stop();
+    }
+
+    bool active() const {
+        return subscriber != nullptr;
+    }
+
+    uint64_t lastPublished() const {
+        return nextSequence - 1;
+    }
+
+    // Events left out because the subscriber fell behind.
+    uint64_t droppedEvents() const {
+        return dropped;
+    }
+
+    void start(unique_ptr<ChangeSubscriber> target, uint64_t firstSequence) {
+        stop();
+        ring = make_unique<SpscRing<ChangeEvent>>(CHANGE_FEED_CAPACITY);
+        subscriber = move(target);
+        nextSequence = firstSequence;
+        waited = {};
+        lagged = false;
+        dropped = 0;
+        droppedChanges = ChangeEvent();
+        droppedPipes.clear();
+        droppedStations.clear();
+        running.store(true, memory_order_release);
+        consumer = thread(&ChangeFeed::drain, this);
+    }
+
+    // A feed stopped while lagged still tells the subscriber what it missed.
+    void stop() {
+        if (!active()) {
+            return;
+        }
+        while (lagged) {
+            waited = {};
+            publishDropped();
+        }
+        running.store(false, memory_order_release);
+        consumer.join();
+        subscriber.reset();
+        ring.reset();
+    }
+
+    void publishPipe(const Pipe* before, const Pipe* after) {
+        ChangeEvent event;
+        event.operation = before == nullptr ? ChangeOperation::Insert : after == nullptr ? ChangeOperation::Delete : ChangeOperation::Update;
+        event.entity = EntityType::Pipe;
+        event.id = after != nullptr ? after->id : before->id;
+        if (after != nullptr) {
+            event.pipe = *after;
+        }
+        publish(move(event));
+    }
+
+    void publishStation(const CompressorStation* before, const CompressorStation* after) {
+        ChangeEvent event;
+        event.operation = before == nullptr ? ChangeOperation::Insert : after == nullptr ? ChangeOperation::Delete : ChangeOperation::Update;
+        event.entity = EntityType::Station;
+        event.id = after != nullptr ? after->id : before->id;
+        if (after != nullptr) {
+            event.station = *after;
+        }
+        publish(move(event));
+    }
+
+    void publishReset() {
+        publish(ChangeEvent());
+    }
+};
+
+#if defined(__unix__) || defined(__APPLE__)
+// Unix domain stream socket, used for replication between local processes.
+class LocalSocket {
+private:
+    int fd = -1;
+
+    explicit LocalSocket(int fd) : fd(fd) {
+        if (fd >= 0) {
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+#ifdef SO_NOSIGPIPE
+            int enabled = 1;
+            setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &enabled, sizeof(enabled));
+#endif
+        }
+    }
+
+    static bool makeAddress(const string& path, sockaddr_un& address) {
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+            return false;
+        }
+        memcpy(address.sun_path, path.c_str(), path.size());
+        return true;
+    }
+
+public:
+    LocalSocket() = default;
+
+    LocalSocket(LocalSocket&& other) noexcept : fd(other.fd) {
+        other.fd = -1;
+    }
+
+    LocalSocket& operator=(LocalSocket&& other) noexcept {
+        if (this != &other) {
+            close();
+            fd = other.fd;
+            other.fd = -1;
+        }
+        return *this;
+    }
+
+    LocalSocket(const LocalSocket&) = delete;
+    LocalSocket& operator=(const LocalSocket&) = delete;
+
+    ~LocalSocket() {
+        close();
+    }
+
+    static bool supported() {
+        return true;
+    }
+
+    // Replaces a stale socket file left by a stopped primary, but never a
+    // live socket or any other kind of file.
+    static LocalSocket listen(const string& path) {
+        sockaddr_un address;
+        struct stat info;
+        if (!makeAddress(path, address) || connect(path).isOpen()) {
+            return LocalSocket();
+        }
+        if (lstat(path.c_str(), &info) == 0 && (!S_ISSOCK(info.st_mode) || unlink(path.c_str()) != 0)) {
+            return LocalSocket();
+        }
+
+        LocalSocket socket(::socket(AF_UNIX, SOCK_STREAM, 0));
+        if (!socket.isOpen() || bind(socket.fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0
+            || ::listen(socket.fd, SOMAXCONN) != 0) {
+            return LocalSocket();
+        }
+        fcntl(socket.fd, F_SETFL, O_NONBLOCK);
+        return socket;
+    }
+
+    static LocalSocket connect(const string& path) {
+        sockaddr_un address;
+        if (!makeAddress(path, address)) {
+            return LocalSocket();
+        }
+        LocalSocket socket(::socket(AF_UNIX, SOCK_STREAM, 0));
+        if (!socket.isOpen() || ::connect(socket.fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0) {
+            return LocalSocket();
+        }
+        return socket;
+    }
+
+    static void removePath(const string& path) {
+        unlink(path.c_str());
+    }
+
+    // Next pending connection, or a closed socket if there is none.
+    LocalSocket accept() const {
+        LocalSocket socket(::accept(fd, nullptr, nullptr));
+        if (socket.isOpen()) {
+            fcntl(socket.fd, F_SETFL, O_NONBLOCK);
+        }
+        return socket;
+    }
+
+    bool isOpen() const {
+        return fd >= 0;
+    }
+
+    void close() {
+        if (fd >= 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+
+    // Sends what fits without blocking; returns the bytes sent or -1 on error.
+    long send(const char* data, size_t size) const {
+        int flags = MSG_DONTWAIT;
+#ifdef MSG_NOSIGNAL
+        flags |= MSG_NOSIGNAL;
+#endif
+        ssize_t sent = ::send(fd, data, size, flags);
+        if (sent < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+        }
+        return static_cast<long>(sent);
+    }
+
+    // Waits up to timeoutMs for data; returns the bytes read, 0 if none
+    // arrived, or -1 once the peer has closed the connection.
+    long receive(char* data, size_t size, int timeoutMs) const {
+        pollfd entry = { fd, POLLIN, 0 };
+        int ready = poll(&entry, 1, timeoutMs);
+        if (ready <= 0) {
+            return ready < 0 && errno != EINTR ? -1 : 0;
+        }
+        ssize_t received = recv(fd, data, size, MSG_DONTWAIT);
+        if (received < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+        }
+        return received == 0 ? -1 : static_cast<long>(received);
+    }
+};
+#else
+// Platforms without Unix domain sockets: every operation fails.
+class LocalSocket {
+public:
+    static bool supported() {
+        return false;
+    }
+
+    static LocalSocket listen(const string&) {
+        return LocalSocket();
+    }
+
+    static LocalSocket connect(const string&) {
+        return LocalSocket();
+    }
+
+    static void removePath(const string&) {}
+
+    LocalSocket accept() const {
+        return LocalSocket();
+    }
+
+    bool isOpen() const {
+        return false;
+    }
+
+    void close() {}
+
+    long send(const char*, size_t) const {
+        return -1;
+    }
+
+    long receive(char*, size_t, int) const {
+        return -1;
+    }
+};
+#endif
+
+// Sends as much of outbox[sent..] as the socket takes without blocking and
+// trims what went out; false once the peer is gone.
+bool sendPending(const LocalSocket& socket, string& outbox, size_t& sent) {
+    while (sent < outbox.size()) {
+        long count = socket.send(outbox.data() + sent, outbox.size() - sent);
+        if (count < 0) {
+            return false;
+        }
+        if (count == 0) {
+            break;
+        }
+        sent += count;
+    }
+    if (sent == outbox.size()) {
+        outbox.clear();
+        sent = 0;
+    } else if (sent > outbox.size() / 2) {
+        outbox.erase(0, sent);
+        sent = 0;
+    }
+    return true;
+}
+
+// Serves the change feed to local consumers over a Unix domain socket. A
+// consumer connects and sends "FROM <sequence>"; the server answers
+// "RESUME <sequence>" with the first sequence number it will send, followed
+// by every retained event from there on in the change feed line format, then
+// each new event. The most recent CHANGE_FEED_SOCKET_BACKLOG bytes of events
+// are retained, so a consumer that reconnects resumes where it stopped; if it
+// asks for older events, RESUME names a later sequence and the consumer must
+// resynchronize. A consumer that falls more than the backlog behind is
+// disconnected, so it never slows down the feed.
+class SocketChangeSubscriber : public ChangeSubscriber {
+private:
+    struct Consumer {
+        LocalSocket socket;
+        string outbox;
+        size_t sent = 0;
+        string inbox;
+        bool started = false;
+        uint64_t from = 0;
+    };
+
+    string path;
+    LocalSocket listener;
+
+    mutex lock;
+    deque<pair<uint64_t, string>> retained;
+    size_t retainedBytes = 0;
+    vector<Consumer> consumers;
+    uint64_t nextSequence;
+
+    atomic<bool> running{ false };
+    thread service;
+
+    // Handles a "FROM <sequence>" request; false once the consumer has disconnected.
+    bool readRequest(Consumer& consumer) {
+        char buffer[256];
+        long received;
+        while ((received = consumer.socket.receive(buffer, sizeof(buffer), 0)) > 0) {
+            consumer.inbox.append(buffer, received);
+        }
+
+        size_t end;
+        while (!consumer.started && (end = consumer.inbox.find('\n')) != string::npos) {
+            if (consumer.inbox.compare(0, 5, "FROM ") == 0) {
+                consumer.from = strtoull(consumer.inbox.c_str() + 5, nullptr, 10);
+                auto first = find_if(retained.begin(), retained.end(),
+                    [&consumer](const pair<uint64_t, string>& entry) { return entry.first >= consumer.from; });
+                uint64_t resume = first == retained.end() ? max(consumer.from, nextSequence) : first->first;
+                consumer.outbox += "RESUME " + to_string(resume) + "\n";
+                for (; first != retained.end(); ++first) {
+                    consumer.outbox += first->second;
+                }
+                consumer.started = true;
+            }
+            consumer.inbox.erase(0, end + 1);
+        }
+        return received == 0;
+    }
+
+    void serviceLoop() {
+        while (running.load(memory_order_acquire)) {
+            {
+                lock_guard<mutex> guard(lock);
+                for (LocalSocket socket = listener.accept(); socket.isOpen(); socket = listener.accept()) {
+                    consumers.emplace_back();
+                    consumers.back().socket = move(socket);
+                }
+                for (Consumer& consumer : consumers) {
+                    if (!readRequest(consumer) || !sendPending(consumer.socket, consumer.outbox, consumer.sent)
+                        || consumer.outbox.size() - consumer.sent > CHANGE_FEED_SOCKET_BACKLOG) {
+                        consumer.socket.close();
+                    }
+                }
+                consumers.erase(remove_if(consumers.begin(), consumers.end(),
+                    [](const Consumer& consumer) { return !consumer.socket.isOpen(); }), consumers.end());
+            }
+            this_thread::sleep_for(chrono::milliseconds(CHANGE_FEED_POLL_MS));
+        }
+    }
+
+public:
+    SocketChangeSubscriber(const string& path, uint64_t firstSequence)
+        : path(path), listener(LocalSocket::listen(path)), nextSequence(firstSequence) {
+        if (listener.isOpen()) {
+            running.store(true, memory_order_release);
+            service = thread(&SocketChangeSubscriber::serviceLoop, this);
+        }
+    }
+
+    ~SocketChangeSubscriber() override {
+        running.store(false, memory_order_release);
+        if (service.joinable()) {
+            service.join();
+        }
+        if (listener.isOpen()) {
+            listener.close();
+            LocalSocket::removePath(path);
+        }
+    }
+
+    bool isListening() const {
+        return listener.isOpen();
+    }
+
+    size_t consumerCount() {
+        lock_guard<mutex> guard(lock);
+        return consumers.size();
+    }
+
+    bool deliver(const ChangeEvent& event) override {
+        ostringstream text;
+        {
+            OutputBuffer out(text);
+            out << event;
+        }
+        string line = text.str();
+
+        lock_guard<mutex> guard(lock);
+        retained.emplace_back(event.sequence, line);
+        retainedBytes += line.size();
+        while (retainedBytes > CHANGE_FEED_SOCKET_BACKLOG) {
+            retainedBytes -= retained.front().second.size();
+            retained.pop_front();
+        }
+        nextSequence = event.sequence + 1;
+        for (Consumer& consumer : consumers) {
+            if (consumer.started && event.sequence >= consumer.from) {
+                consumer.outbox += line;
+            }
+        }
+        return true;
+    }
+
+    void flush() override {
+        lock_guard<mutex> guard(lock);
+        for (Consumer& consumer : consumers) {
+            if (!sendPending(consumer.socket, consumer.outbox, consumer.sent)) {
+                consumer.socket.close();
+            }
+        }
+    }
+};
+
+// Prints a socket change feed from the given sequence number until the feed stops.
+bool subscribeToChangeFeed(const string& path, uint64_t from) {
+    LocalSocket socket = LocalSocket::connect(path);
+    string request = "FROM " + to_string(from) + "\n";
+    size_t sent = 0;
+    if (!socket.isOpen() || !sendPending(socket, request, sent) || !request.empty()) {
+        cout << "Error: Could not connect to change feed at " << path << endl;
+        return false;
+    }
+
+    char buffer[65536];
+    long received;
+    while ((received = socket.receive(buffer, sizeof(buffer), 1000)) >= 0) {
+        cout.write(buffer, received);
+        cout.flush();
+    }
+    return true;
+}
+
+// Primary side of log shipping. Each follower that connects gets a snapshot
+// of the current state ("SNAPSHOT <sequence>", save-file sections, "END"),
+// then every change event in the change feed line format, and a heartbeat
+// with the last sequence number every second. Output is queued per follower
+// so a slow follower never blocks the feed; one that falls more than
+// REPLICATION_MAX_BACKLOG bytes behind is disconnected.
+class ReplicationServer : public ChangeSubscriber {
+public:
+    // Writes the current state and returns the last sequence number it
+    // includes. Called with the state lock held.
+    using SnapshotWriter = function<uint64_t(ostream&)>;
+
+    struct FollowerStatus {
+        int number;
+        uint64_t acknowledged;
+        size_t backlog;
+        bool synchronized;
+    };
+
+private:
+    struct Follower {
+        int number = 0;
+        LocalSocket socket;
+        string outbox;
+        size_t sent = 0;
+        size_t backlogLimit = REPLICATION_MAX_BACKLOG;
+        string inbox;
+        uint64_t acknowledged = 0;
+        bool needsSnapshot = true;
+    };
+
+    string path;
+    LocalSocket listener;
+    mutex& stateLock;
+    SnapshotWriter writeSnapshot;
+
+    mutex lock;
+    vector<Follower> followers;
+    int nextNumber = 1;
+    size_t disconnected = 0;
+
+    ostringstream pendingText;
+    OutputBuffer pending{ pendingText };
+    bool resetPending = false;
+    atomic<uint64_t> lastDelivered{ 0 };
+
+    atomic<bool> running{ false };
+    thread service;
+
+    static bool sendQueued(Follower& follower) {
+        return sendPending(follower.socket, follower.outbox, follower.sent);
+    }
+
+    // Reads "ACK <sequence>" lines; false once the follower has disconnected.
+    static bool readAcknowledgements(Follower& follower) {
+        char buffer[4096];
+        long received;
+        while ((received = follower.socket.receive(buffer, sizeof(buffer), 0)) > 0) {
+            follower.inbox.append(buffer, received);
+        }
+
+        size_t end;
+        while ((end = follower.inbox.find('\n')) != string::npos) {
+            if (follower.inbox.compare(0, 4, "ACK ") == 0) {
+                follower.acknowledged = strtoull(follower.inbox.c_str() + 4, nullptr, 10);
+            }
+            follower.inbox.erase(0, end + 1);
+        }
+        return received == 0;
+    }
+
+    // Snapshots are taken only when the state is not being edited, so the
+    // snapshot and its sequence number always match.
+    void sendSnapshots() {
+        {
+            lock_guard<mutex> guard(lock);
+            if (none_of(followers.begin(), followers.end(), [](const Follower& follower) { return follower.needsSnapshot; })) {
+                return;
+            }
+        }
+
+        unique_lock<mutex> state(stateLock, try_to_lock);
+        if (!state.owns_lock()) {
+            return;
+        }
+        ostringstream body;
+        uint64_t sequence = writeSnapshot(body);
+        string message = "SNAPSHOT " + to_string(sequence) + "\n" + body.str() + "END\n";
+
+        lock_guard<mutex> guard(lock);
+        for (Follower& follower : followers) {
+            if (follower.needsSnapshot) {
+                follower.outbox += message;
+                follower.backlogLimit = REPLICATION_MAX_BACKLOG + message.size();
+                follower.needsSnapshot = false;
+            }
+        }
+    }
+
+    void serviceLoop() {
+        auto lastHeartbeat = chrono::steady_clock::now();
+        while (running.load(memory_order_acquire)) {
+            for (LocalSocket socket = listener.accept(); socket.isOpen(); socket = listener.accept()) {
+                lock_guard<mutex> guard(lock);
+                followers.emplace_back();
+                followers.back().number = nextNumber++;
+                followers.back().socket = move(socket);
+            }
+            sendSnapshots();
+
+            bool heartbeat = chrono::steady_clock::now() - lastHeartbeat >= chrono::milliseconds(REPLICATION_HEARTBEAT_MS);
+            if (heartbeat) {
+                lastHeartbeat = chrono::steady_clock::now();
+            }
+
+            {
+                lock_guard<mutex> guard(lock);
+                for (Follower& follower : followers) {
+                    if (heartbeat && !follower.needsSnapshot) {
+                        follower.outbox += "HEARTBEAT " + to_string(lastDelivered.load()) + " " + to_string(EventHistory::now()) + "\n";
+                    }
+                    if (!sendQueued(follower) || !readAcknowledgements(follower)
+                        || follower.outbox.size() - follower.sent > follower.backlogLimit) {
+                        follower.socket.close();
+                    }
+                }
+                size_t before = followers.size();
+                followers.erase(remove_if(followers.begin(), followers.end(),
+                    [](const Follower& follower) { return !follower.socket.isOpen(); }), followers.end());
+                disconnected += before - followers.size();
+            }
+
+            this_thread::sleep_for(chrono::milliseconds(REPLICATION_POLL_MS));
+        }
+    }
+
+public:
+    ReplicationServer(const string& path, mutex& stateLock, SnapshotWriter writeSnapshot)
+        : path(path), listener(LocalSocket::listen(path)), stateLock(stateLock), writeSnapshot(move(writeSnapshot)) {
+        if (listener.isOpen()) {
+            running.store(true, memory_order_release);
+            service = thread(&ReplicationServer::serviceLoop, this);
+        }
+    }
+
+    ~ReplicationServer() override {
+        running.store(false, memory_order_release);
+        if (service.joinable()) {
+            service.join();
+        }
+        if (listener.isOpen()) {
+            listener.close();
+            LocalSocket::removePath(path);
+        }
+    }
+
+    bool isListening() const {
+        return listener.isOpen();
+    }
+
+    const string& socketPath() const {
+        return path;
+    }
+
+    uint64_t lastSequence() const {
+        return lastDelivered.load();
+    }
+
+    bool deliver(const ChangeEvent& event) override {
+        pending << event;
+        lastDelivered.store(event.sequence);
+        resetPending = resetPending || event.operation == ChangeOperation::Reset;
+        return true;
+    }
+
+    // Followers still waiting for a snapshot skip these events: the snapshot
+    // is taken later, so it already contains them.
+    void flush() override {
+        pending.flush();
+        string text = pendingText.str();
+        pendingText.str("");
+
+        lock_guard<mutex> guard(lock);
+        for (Follower& follower : followers) {
+            if (!follower.needsSnapshot) {
+                follower.outbox += text;
+                follower.needsSnapshot = resetPending;
+                if (!sendQueued(follower)) {
+                    follower.socket.close();
+                }
+            }
+        }
+        resetPending = false;
+    }
+
+    vector<FollowerStatus> followerStatus() {
+        lock_guard<mutex> guard(lock);
+        vector<FollowerStatus> status;
+        for (const Follower& follower : followers) {
+            status.push_back({ follower.number, follower.acknowledged, follower.outbox.size() - follower.sent, !follower.needsSnapshot });
+        }
+        return status;
+    }
+
+    size_t disconnectedFollowers() {
+        lock_guard<mutex> guard(lock);
+        return disconnected;
+    }
+};
+
+// Follower side of log shipping: a background thread reads the primary's
+// stream, applies snapshots and change events under the state lock and
+// acknowledges the last applied sequence number. After a RESET event it
+// ignores changes until the primary sends the new snapshot.
+class ReplicationFollower {
+public:
+    using SnapshotApplier = function<void(const string&)>;
+    using EventApplier = function<void(const vector<string>&)>;
+
+private:
+    string path;
+    LocalSocket socket;
+    mutex& stateLock;
+    SnapshotApplier applySnapshot;
+    EventApplier applyEvents;
+
+    atomic<bool> running{ false };
+    atomic<bool> connected{ false };
+    atomic<uint64_t> appliedSequence{ 0 };
+    atomic<uint64_t> primarySequence{ 0 };
+    atomic<int64_t> appliedTimestamp{ 0 };
+    atomic<int64_t> lastContact{ 0 };
+    atomic<uint64_t> snapshotsApplied{ 0 };
+    atomic<uint64_t> changesApplied{ 0 };
+    thread receiver;
+
+    // Waits for the state lock; gives up if the follower is stopped meanwhile.
+    bool lockState() {
+        while (!stateLock.try_lock()) {
+            if (!running.load(memory_order_acquire)) {
+                return false;
+            }
+            this_thread::sleep_for(chrono::milliseconds(1));
+        }
+        return true;
+    }
+
+    void notePrimarySequence(uint64_t sequence) {
+        if (sequence > primarySequence.load()) {
+            primarySequence.store(sequence);
+        }
+    }
+
+    bool applyQueued(vector<string>& lines, uint64_t sequence, int64_t timestamp) {
+        if (lines.empty()) {
+            return true;
+        }
+        if (!lockState()) {
+            return false;
+        }
+        applyEvents(lines);
+        stateLock.unlock();
+        changesApplied += lines.size();
+        lines.clear();
+        appliedTimestamp.store(timestamp);
+        appliedSequence.store(sequence);
+        return true;
+    }
+
+    // Applies one connection's stream until it ends or the follower stops.
+    void followStream() {
+        string buffer, snapshot;
+        vector<string> lines;
+        bool inSnapshot = false;
+        bool awaitingSnapshot = true;
+        uint64_t snapshotSequence = 0;
+        uint64_t accepted = 0;
+        int64_t acceptedTimestamp = 0;
+        uint64_t acknowledged = 0;
+        vector<char> chunk(1 << 16);
+
+        while (running.load(memory_order_acquire)) {
+            long received = socket.receive(chunk.data(), chunk.size(), REPLICATION_HEARTBEAT_MS / 10);
+            if (received < 0) {
+                break;
+            }
+            if (received == 0) {
+                continue;
+            }
+            lastContact.store(EventHistory::now());
+            buffer.append(chunk.data(), received);
+
+            size_t start = 0, end;
+            while ((end = buffer.find('\n', start)) != string::npos) {
+                string line = buffer.substr(start, end - start);
+                start = end + 1;
+
+                if (inSnapshot) {
+                    if (line != "END") {
+                        snapshot += line;
+                        snapshot += '\n';
+                        continue;
+                    }
+                    if (!lockState()) {
+                        return;
+                    }
+                    applySnapshot(snapshot);
+                    stateLock.unlock();
+                    snapshot.clear();
+                    inSnapshot = false;
+                    awaitingSnapshot = false;
+                    accepted = snapshotSequence;
+                    appliedSequence.store(accepted);
+                    primarySequence.store(accepted);
+                    snapshotsApplied++;
+                } else if (line.compare(0, 9, "SNAPSHOT ") == 0) {
+                    if (!applyQueued(lines, accepted, acceptedTimestamp)) {
+                        return;
+                    }
+                    inSnapshot = true;
+                    snapshotSequence = strtoull(line.c_str() + 9, nullptr, 10);
+                } else if (line.compare(0, 10, "HEARTBEAT ") == 0) {
+                    notePrimarySequence(strtoull(line.c_str() + 10, nullptr, 10));
+                } else {
+                    char* rest;
+                    uint64_t sequence = strtoull(line.c_str(), &rest, 10);
+                    int64_t timestamp = strtoll(rest, &rest, 10);
+                    notePrimarySequence(sequence);
+                    if (strncmp(rest, " RESET", 6) == 0) {
+                        awaitingSnapshot = true;
+                    } else if (!awaitingSnapshot && sequence > accepted) {
+                        lines.push_back(move(line));
+                        accepted = sequence;
+                        acceptedTimestamp = timestamp;
+                    }
+                }
+            }
+            buffer.erase(0, start);
+
+            if (!applyQueued(lines, accepted, acceptedTimestamp)) {
+                return;
+            }
+            if (appliedSequence.load() != acknowledged) {
+                acknowledged = appliedSequence.load();
+                string acknowledgement = "ACK " + to_string(acknowledged) + "\n";
+                socket.send(acknowledgement.data(), acknowledgement.size());
+            }
+        }
+    }
+
+    // A lost primary is retried every heartbeat interval; each new
+    // connection starts again from a snapshot.
+    void receiveLoop() {
+        int waited = 0;
+        while (running.load(memory_order_acquire)) {
+            if (!socket.isOpen()) {
+                this_thread::sleep_for(chrono::milliseconds(REPLICATION_POLL_MS));
+                waited += REPLICATION_POLL_MS;
+                if (waited < REPLICATION_HEARTBEAT_MS) {
+                    continue;
+                }
+                waited = 0;
+                socket = LocalSocket::connect(path);
+                if (!socket.isOpen()) {
+                    continue;
+                }
+                connected.store(true);
+            }
+
+            followStream();
+            socket.close();
+            connected.store(false);
+        }
+    }
+
+public:
+    ReplicationFollower(const string& path, mutex& stateLock, SnapshotApplier applySnapshot, EventApplier applyEvents)
+        : path(path), stateLock(stateLock), applySnapshot(move(applySnapshot)), applyEvents(move(applyEvents)) {}
+
+    ~ReplicationFollower() {
+        stop();
+    }
+
+    bool start() {
+        socket = LocalSocket::connect(path);
+        if (!socket.isOpen()) {
+            return false;
+        }
+        connected.store(true);
+        running.store(true, memory_order_release);
+        receiver = thread(&ReplicationFollower::receiveLoop, this);
+        return true;
+    }
+
+    void stop() {
+        running.store(false, memory_order_release);
+        if (receiver.joinable()) {
+            receiver.join();
+        }
+        socket.close();
+        connected.store(false);
+    }
+
+    const string& socketPath() const {
+        return path;
+    }
+
+    bool isConnected() const {
+        return connected.load();
+    }
+
+    uint64_t applied() const {
+        return appliedSequence.load();
+    }
+
+    uint64_t primary() const {
+        return max(primarySequence.load(), appliedSequence.load());
+    }
+
+    int64_t appliedAt() const {
+        return appliedTimestamp.load();
+    }
+
+    int64_t lastMessageAt() const {
+        return lastContact.load();
+    }
+
+    uint64_t snapshots() const {
+        return snapshotsApplied.load();
+    }
+
+    uint64_t changes() const {
+        return changesApplied.load();
+    }
+};
+
+// Stream buffer for the interactive input stream. It releases `lock` while it
+// waits for input, so replication can apply or snapshot the state while the
+// user sits at a prompt. The reading thread must hold the lock otherwise.
+class UnlockingInputBuffer : public streambuf {
+private:
+    istream& in;
+    streambuf* source;
+    mutex& lock;
+    char buffer[256];
+
+protected:
+    int_type underflow() override {
+        if (gptr() < egptr()) {
+            return traits_type::to_int_type(*gptr());
+        }
+
+        lock.unlock();
+        int_type next = source->sbumpc();
+        lock.lock();
+        if (traits_type::eq_int_type(next, traits_type::eof())) {
+            return traits_type::eof();
+        }
+
+        size_t count = 0;
+        buffer[count++] = traits_type::to_char_type(next);
+        while (count < sizeof(buffer) && source->in_avail() > 0) {
+            buffer[count++] = traits_type::to_char_type(source->sbumpc());
+        }
+        setg(buffer, buffer, buffer + count);
+        return traits_type::to_int_type(buffer[0]);
+    }
+
+public:
+    UnlockingInputBuffer(istream& in, mutex& lock) : in(in), source(in.rdbuf()), lock(lock) {
+        in.rdbuf(this);
+    }
+
+    ~UnlockingInputBuffer() override {
+        in.rdbuf(source);
+    }
+};
+
+// Fixed set of threads that split an index range into chunks; run() returns
+// once every chunk is done, which gives each simulation pass a barrier.
+class WorkerPool {
+private:
+    vector<thread> workers;
+    mutex lock;
+    condition_variable wake;
+    condition_variable finished;
+    const function<void(size_t, size_t)>* task = nullptr;
+    size_t taskSize = 0;
+    size_t chunkSize = 1;
+    atomic<size_t> nextChunk{ 0 };
+    size_t generation = 0;
+    size_t busyWorkers = 0;
+    bool stopping = false;
+
+    void processChunks() {
+        for (size_t begin = nextChunk.fetch_add(chunkSize); begin < taskSize; begin = nextChunk.fetch_add(chunkSize)) {
+            (*task)(begin, min(begin + chunkSize, taskSize));
+        }
+    }
+
+    void workerLoop() {
+        size_t seenGeneration = 0;
+        while (true) {
+            {
+                unique_lock<mutex> guard(lock);
+                wake.wait(guard, [&]() { return stopping || generation != seenGeneration; });
+                if (stopping) {
+                    return;
+                }
+                seenGeneration = generation;
+            }
+
+            processChunks();
+
+            unique_lock<mutex> guard(lock);
+            if (--busyWorkers == 0) {
+                finished.notify_one();
+            }
+        }
+    }
+
+public:
+    explicit WorkerPool(size_t threadCount = thread::hardware_concurrency()) {
+        for (size_t i = 1; i < threadCount; i++) {
+            workers.emplace_back(&WorkerPool::workerLoop, this);
+        }
+    }
+
+    ~WorkerPool() {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (thread& worker : workers) {
+            worker.join();
+        }
+    }
+
+    size_t threadCount() const {
+        return workers.size() + 1;
+    }
+
+    void run(size_t count, const function<void(size_t, size_t)>& body) {
+        if (workers.empty() || count < 1024) {
+            if (count > 0) {
+                body(0, count);
+            }
+            return;
+        }
+
+        {
+            lock_guard<mutex> guard(lock);
+            task = &body;
+            taskSize = count;
+            chunkSize = max<size_t>(256, count / (threadCount() * 8));
+            nextChunk.store(0);
+            busyWorkers = workers.size();
+            generation++;
+        }
+        wake.notify_all();
+
+        processChunks();
+
+        unique_lock<mutex> guard(lock);
+        finished.wait(guard, [&]() { return busyWorkers == 0; });
+        task = nullptr;
+    }
+};
+
+// Temporary edits applied to the simulation copy only.
+struct SimulationScenario {
+    unordered_map<int, bool> pipeUnderRepair;
+    unordered_map<int, unsigned int> stationActiveWorkshops;
+};
+
+struct SimulationResult {
+    double supplied = 0.0;
+    double delivered = 0.0;
+    double initialLinepack = 0.0;
+    double finalLinepack = 0.0;
+    vector<double> deliveredPerHour;
+    size_t activePipes = 0;
+    size_t starvedSinks = 0;
+};
+
+// Gas transport over the pipe graph, stepped in fixed time steps. Station
+// inventory sets the pressure, compressors raise the outlet pressure by their
+// share of active workshops, and each operational pipe carries flow
+// proportional to the pressure drop and to diameter^2.5 / sqrt(length).
+// Stations without incoming pipes are sources and stations without outgoing
+// pipes are consumers. Data is kept in flat arrays with pipes ordered by start
+// station; every pass writes only its own index, so passes run in parallel
+// without locks.
+class FlowSimulator {
+private:
+    vector<double> inventory;
+    vector<double> boost;
+    vector<char> isSource;
+    vector<char> isSink;
+
+    vector<int> pipeFrom;
+    vector<int> pipeTo;
+    vector<double> conductance;
+    vector<double> flow;
+
+    vector<size_t> outgoingStart;
+    vector<size_t> incomingStart;
+    vector<int> incomingPipes;
+
+    static void buildAdjacency(size_t stationCount, const vector<int>& endpoint, vector<size_t>& start, vector<int>& list) {
+        start.assign(stationCount + 1, 0);
+        for (int station : endpoint) {
+            start[station + 1]++;
+        }
+        for (size_t i = 0; i < stationCount; i++) {
+            start[i + 1] += start[i];
+        }
+        list.resize(endpoint.size());
+        vector<size_t> position(start.begin(), start.end() - 1);
+        for (size_t pipe = 0; pipe < endpoint.size(); pipe++) {
+            list[position[endpoint[pipe]]++] = static_cast<int>(pipe);
+        }
+    }
+
+public:
+    void build(const PipeMap& pipes, const StationMap& stations, const SimulationScenario& scenario) {
+        unordered_map<int, int> stationIndex;
+        stationIndex.reserve(stations.size());
+        inventory.clear();
+        boost.clear();
+        vector<const CompressorStation*> ordered;
+        ordered.reserve(stations.size());
+        for (const auto& pair : stations) {
+            ordered.push_back(&pair.second);
+        }
+        sort(ordered.begin(), ordered.end(), [](const CompressorStation* a, const CompressorStation* b) { return a->id < b->id; });
+
+        for (const CompressorStation* record : ordered) {
+            const CompressorStation& station = *record;
+            unsigned int active = station.activeWorkshops;
+            auto overridden = scenario.stationActiveWorkshops.find(station.id);
+            if (overridden != scenario.stationActiveWorkshops.end()) {
+                active = min(overridden->second, station.totalWorkshops);
+            }
+
+            stationIndex[station.id] = static_cast<int>(inventory.size());
+            inventory.push_back(SIMULATION_STATION_VOLUME * 0.5);
+            boost.push_back(1.0 + (station.totalWorkshops > 0 ? SIMULATION_COMPRESSOR_BOOST * active / station.totalWorkshops : 0.0));
+        }
+
+        vector<tuple<int, int, double>> connected;
+        for (const auto& pair : pipes) {
+            const Pipe& pipe = pair.second;
+            bool underRepair = pipe.underRepair;
+            auto overridden = scenario.pipeUnderRepair.find(pipe.id);
+            if (overridden != scenario.pipeUnderRepair.end()) {
+                underRepair = overridden->second;
+            }
+
+            auto from = stationIndex.find(pipe.startStationId);
+            auto to = stationIndex.find(pipe.endStationId);
+            if (underRepair || from == stationIndex.end() || to == stationIndex.end() || from == to) {
+                continue;
+            }
+
+            connected.emplace_back(from->second, to->second, SIMULATION_CONDUCTANCE * pow(pipe.diameter / 1000.0, 2.5) / sqrt(max(pipe.length, 1)));
+        }
+        sort(connected.begin(), connected.end());
+
+        pipeFrom.clear();
+        pipeTo.clear();
+        conductance.clear();
+        for (const auto& pipe : connected) {
+            pipeFrom.push_back(get<0>(pipe));
+            pipeTo.push_back(get<1>(pipe));
+            conductance.push_back(get<2>(pipe));
+        }
+
+        size_t stationCount = inventory.size();
+        vector<int> outgoingPipes;
+        buildAdjacency(stationCount, pipeFrom, outgoingStart, outgoingPipes);
+        buildAdjacency(stationCount, pipeTo, incomingStart, incomingPipes);
+
+        isSource.assign(stationCount, 0);
+        isSink.assign(stationCount, 0);
+        for (size_t i = 0; i < stationCount; i++) {
+            bool hasIncoming = incomingStart[i] != incomingStart[i + 1];
+            bool hasOutgoing = outgoingStart[i] != outgoingStart[i + 1];
+            isSource[i] = hasOutgoing && !hasIncoming;
+            isSink[i] = hasIncoming && !hasOutgoing;
+        }
+        flow.assign(pipeFrom.size(), 0.0);
+    }
+
+    // stepSeconds must divide 3600, so every reported hour is exactly one hour.
+    SimulationResult run(WorkerPool& pool, int hours, int stepSeconds) {
+        SimulationResult result;
+        result.activePipes = pipeFrom.size();
+        result.deliveredPerHour.assign(hours, 0.0);
+        for (double value : inventory) {
+            result.initialLinepack += value;
+        }
+
+        size_t stationCount = inventory.size();
+        double dt = stepSeconds;
+        vector<double> deliveredByStation(stationCount, 0.0);
+        vector<double> suppliedByStation(stationCount, 0.0);
+
+        double* level = inventory.data();
+        double* pipeFlow = flow.data();
+        const double* stationBoost = boost.data();
+        const double* pipeConductance = conductance.data();
+        const int* target = pipeTo.data();
+        const int* incoming = incomingPipes.data();
+        const size_t* outgoingBegin = outgoingStart.data();
+        const size_t* incomingBegin = incomingStart.data();
+        const char* source = isSource.data();
+        const char* sink = isSink.data();
+        double* supplied = suppliedByStation.data();
+        double* delivered = deliveredByStation.data();
+
+        function<void(size_t, size_t)> computeOutflows = [=](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                double outlet = level[i] / SIMULATION_STATION_VOLUME * stationBoost[i];
+                double requested = 0.0;
+                for (size_t p = outgoingBegin[i]; p < outgoingBegin[i + 1]; p++) {
+                    double inlet = level[target[p]] / SIMULATION_STATION_VOLUME;
+                    double amount = outlet > inlet ? pipeConductance[p] * (outlet - inlet) * dt : 0.0;
+                    pipeFlow[p] = amount;
+                    requested += amount;
+                }
+                if (requested > level[i]) {
+                    double scale = level[i] / requested;
+                    for (size_t p = outgoingBegin[i]; p < outgoingBegin[i + 1]; p++) {
+                        pipeFlow[p] *= scale;
+                    }
+                }
+            }
+        };
+
+        function<void(size_t, size_t)> updateStations = [=](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                double next = level[i];
+                for (size_t k = incomingBegin[i]; k < incomingBegin[i + 1]; k++) {
+                    next += pipeFlow[incoming[k]];
+                }
+                for (size_t p = outgoingBegin[i]; p < outgoingBegin[i + 1]; p++) {
+                    next -= pipeFlow[p];
+                }
+
+                if (source[i]) {
+                    double supply = min(SIMULATION_SOURCE_SUPPLY * dt, SIMULATION_STATION_VOLUME - min(next, SIMULATION_STATION_VOLUME));
+                    next += supply;
+                    supplied[i] += supply;
+                }
+                if (sink[i]) {
+                    double delivery = min(SIMULATION_SINK_DEMAND * dt, max(next, 0.0));
+                    next -= delivery;
+                    delivered[i] += delivery;
+                }
+                level[i] = next > 1e-9 ? next : 0.0;
+            }
+        };
+
+        int stepsPerHour = 3600 / stepSeconds;
+        for (int hour = 0; hour < hours; hour++) {
+            for (int step = 0; step < stepsPerHour; step++) {
+                pool.run(stationCount, computeOutflows);
+                pool.run(stationCount, updateStations);
+            }
+
+            double total = 0.0;
+            for (double value : deliveredByStation) {
+                total += value;
+            }
+            result.deliveredPerHour[hour] = total - result.delivered;
+            result.delivered = total;
+        }
+
+        for (size_t i = 0; i < stationCount; i++) {
+            result.supplied += suppliedByStation[i];
+            result.finalLinepack += inventory[i];
+            if (isSink[i] && inventory[i] < SIMULATION_SINK_DEMAND * dt) {
+                result.starvedSinks++;
+            }
+        }
+        return result;
+    }
+};
+
+class DisjointSets {
+private:
+    vector<int> parent;
+    vector<long long> componentSize;
+
+public:
+    explicit DisjointSets(size_t count = 0) : parent(count), componentSize(count, 1) {
+        for (size_t i = 0; i < count; i++) {
+            parent[i] = static_cast<int>(i);
+        }
+    }
+
+    int find(int item) const {
+        while (parent[item] != item) {
+            item = parent[item];
+        }
+        return item;
+    }
+
+    int findAndCompress(int item) {
+        int root = find(item);
+        while (parent[item] != root) {
+            int next = parent[item];
+            parent[item] = root;
+            item = next;
+        }
+        return root;
+    }
+
+    long long size(int root) const {
+        return componentSize[root];
+    }
+
+    // Returns the surviving root.
+    int unite(int a, int b) {
+        a = findAndCompress(a);
+        b = findAndCompress(b);
+        if (a == b) {
+            return a;
+        }
+        if (componentSize[a] < componentSize[b]) {
+            swap(a, b);
+        }
+        parent[b] = a;
+        componentSize[a] += componentSize[b];
+        return a;
+    }
+};
+
+struct RepairPriority {
+    int pipeId = 0;
+    double score = 0.0;
+    double capacity = 0.0;
+    long long reconnectedPairs = 0;
+};
+
+// Greedy ranking of pipes under repair. A candidate's score is its flow
+// capacity (diameter^2.5 / sqrt(length)) times one plus the number of station
+// pairs it would reconnect. After each pick only candidates touching the two
+// merged components are rescored, and candidates that no longer bridge two
+// components drop out of the per-component lists. A tournament tree over the
+// scores yields the best remaining candidate in O(1) and absorbs each rescore
+// in O(log n).
+class RepairPrioritizer {
+private:
+    vector<int> candidatePipe;
+    vector<int> candidateStart;
+    vector<int> candidateEnd;
+    vector<double> candidateCapacity;
+    vector<double> score;
+    vector<long long> pairs;
+    DisjointSets components;
+    unordered_map<int, vector<int>> candidatesByRoot;
+    vector<int> tree;
+    size_t leafCount = 1;
+
+    int better(int a, int b) const {
+        if (a < 0 || b < 0) {
+            return a < 0 ? b : a;
+        }
+        if (score[a] != score[b]) {
+            return score[a] > score[b] ? a : b;
+        }
+        return candidatePipe[a] < candidatePipe[b] ? a : b;
+    }
+
+    void updateTree(int candidate, bool remove) {
+        size_t node = leafCount + candidate;
+        tree[node] = remove ? -1 : candidate;
+        for (node /= 2; node > 0; node /= 2) {
+            tree[node] = better(tree[2 * node], tree[2 * node + 1]);
+        }
+    }
+
+    void rescore(const vector<int>& candidates, WorkerPool& pool) {
+        pool.run(candidates.size(), [&](size_t begin, size_t end) {
+            for (size_t k = begin; k < end; k++) {
+                int c = candidates[k];
+                long long reconnected = 0;
+                if (candidateStart[c] >= 0) {
+                    int a = components.find(candidateStart[c]);
+                    int b = components.find(candidateEnd[c]);
+                    reconnected = a == b ? 0 : components.size(a) * components.size(b);
+                }
+                pairs[c] = reconnected;
+                score[c] = candidateCapacity[c] * (1.0 + reconnected);
+            }
+        });
+    }
+
+public:
+    vector<RepairPriority> rank(const PipeMap& pipes, const StationMap& stations, size_t limit, WorkerPool& pool) {
+        unordered_map<int, int> stationIndex;
+        stationIndex.reserve(stations.size());
+        for (const auto& pair : stations) {
+            stationIndex.emplace(pair.first, static_cast<int>(stationIndex.size()));
+        }
+        components = DisjointSets(stationIndex.size());
+
+        candidatePipe.clear();
+        candidateStart.clear();
+        candidateEnd.clear();
+        candidateCapacity.clear();
+        candidatesByRoot.clear();
+        for (const auto& pair : pipes) {
+            const Pipe& pipe = pair.second;
+            auto from = stationIndex.find(pipe.startStationId);
+            auto to = stationIndex.find(pipe.endStationId);
+            bool connected = from != stationIndex.end() && to != stationIndex.end();
+
+            if (!pipe.underRepair) {
+                if (connected) {
+                    components.unite(from->second, to->second);
+                }
+                continue;
+            }
+
+            candidatePipe.push_back(pipe.id);
+            candidateStart.push_back(connected ? from->second : -1);
+            candidateEnd.push_back(connected ? to->second : -1);
+            candidateCapacity.push_back(pow(pipe.diameter / 1000.0, 2.5) / sqrt(max(pipe.length, 1)));
+        }
+
+        size_t count = candidatePipe.size();
+        score.assign(count, 0.0);
+        pairs.assign(count, 0);
+
+        vector<int> all(count);
+        for (size_t c = 0; c < count; c++) {
+            all[c] = static_cast<int>(c);
+        }
+        rescore(all, pool);
+
+        for (size_t c = 0; c < count; c++) {
+            if (pairs[c] > 0) {
+                candidatesByRoot[components.findAndCompress(candidateStart[c])].push_back(static_cast<int>(c));
+                candidatesByRoot[components.findAndCompress(candidateEnd[c])].push_back(static_cast<int>(c));
+            }
+        }
+
+        leafCount = 1;
+        while (leafCount < count) {
+            leafCount *= 2;
+        }
+        tree.assign(2 * leafCount, -1);
+        for (size_t c = 0; c < count; c++) {
+            tree[leafCount + c] = static_cast<int>(c);
+        }
+        for (size_t node = leafCount - 1; node > 0; node--) {
+            tree[node] = better(tree[2 * node], tree[2 * node + 1]);
+        }
+
+        vector<RepairPriority> ranking;
+        while (count > 0 && tree[1] >= 0 && ranking.size() < limit) {
+            int c = tree[1];
+            RepairPriority priority;
+            priority.pipeId = candidatePipe[c];
+            priority.score = score[c];
+            priority.capacity = candidateCapacity[c];
+            priority.reconnectedPairs = pairs[c];
+            ranking.push_back(priority);
+            updateTree(c, true);
+
+            if (candidateStart[c] < 0 || pairs[c] == 0) {
+                continue;
+            }
+
+            int a = components.findAndCompress(candidateStart[c]);
+            int b = components.findAndCompress(candidateEnd[c]);
+            int root = components.unite(a, b);
+            int absorbed = root == a ? b : a;
+
+            vector<int>& survivors = candidatesByRoot[root];
+            vector<int>& moved = candidatesByRoot[absorbed];
+            if (survivors.size() < moved.size()) {
+                survivors.swap(moved);
+            }
+            survivors.insert(survivors.end(), moved.begin(), moved.end());
+            candidatesByRoot.erase(absorbed);
+
+            vector<int>& incident = candidatesByRoot[root];
+            vector<int> affected;
+            size_t kept = 0;
+            for (int candidate : incident) {
+                if (tree[leafCount + candidate] < 0) {
+                    continue;
+                }
+                if (components.find(candidateStart[candidate]) == components.find(candidateEnd[candidate])) {
+                    if (pairs[candidate] != 0) {
+                        pairs[candidate] = 0;
+                        score[candidate] = candidateCapacity[candidate];
+                        updateTree(candidate, false);
+                    }
+                    continue;
+                }
+                incident[kept++] = candidate;
+                affected.push_back(candidate);
+            }
+            incident.resize(kept);
+
+            rescore(affected, pool);
+            for (int candidate : affected) {
+                updateTree(candidate, false);
+            }
+        }
+        return ranking;
+    }
+};
+
+enum class PipeGroupField { Network, Diameter, RepairStatus, Length };
+enum class StationGroupField { Network, StationClass, TotalWorkshops };
+
+struct PipeTotals {
+    long long count = 0;
+    long long totalLength = 0;
+    long long underRepairCount = 0;
+    long long underRepairLength = 0;
+};
+
+struct StationTotals {
+    long long count = 0;
+    long long totalWorkshops = 0;
+    long long activeWorkshops = 0;
+    long long utilizedStations = 0;
+    double utilizationSum = 0.0;
+};
+
+// Keeps per-group totals up to date from the before/after images of each
+// changed record, so statistics never need a scan over the network.
+class NetworkAggregates {
+private:
+    map<PipeGroupField, unordered_map<long long, PipeTotals>> pipeGroups;
+    map<StationGroupField, unordered_map<long long, StationTotals>> stationGroups;
+
+    static long long pipeKey(PipeGroupField field, const Pipe& pipe) {
+        switch (field) {
+            case PipeGroupField::Diameter:
+                return pipe.diameter;
+            case PipeGroupField::RepairStatus:
+                return pipe.underRepair ? 1 : 0;
+            case PipeGroupField::Length:
+                return pipe.length;
+            case PipeGroupField::Network:
+                break;
+        }
+        return 0;
+    }
+
+    static long long stationKey(StationGroupField field, const CompressorStation& station) {
+        switch (field) {
+            case StationGroupField::StationClass:
+                return station.stationClass;
+            case StationGroupField::TotalWorkshops:
+                return station.totalWorkshops;
+            case StationGroupField::Network:
+                break;
+        }
+        return 0;
+    }
+
+    static void apply(unordered_map<long long, PipeTotals>& groups, long long key, const Pipe& pipe, int sign) {
+        PipeTotals& totals = groups[key];
+        totals.count += sign;
+        totals.totalLength += sign * (long long)pipe.length;
+        if (pipe.underRepair) {
+            totals.underRepairCount += sign;
+            totals.underRepairLength += sign * (long long)pipe.length;
+        }
+        if (totals.count == 0) {
+            groups.erase(key);
+        }
+    }
+
+    static void apply(unordered_map<long long, StationTotals>& groups, long long key, const CompressorStation& station, int sign) {
+        StationTotals& totals = groups[key];
+        totals.count += sign;
+        totals.totalWorkshops += sign * (long long)station.totalWorkshops;
+        totals.activeWorkshops += sign * (long long)station.activeWorkshops;
+        if (station.totalWorkshops > 0) {
+            totals.utilizedStations += sign;
+            totals.utilizationSum += sign * (double)station.activeWorkshops / station.totalWorkshops;
+        }
+        if (totals.count == 0) {
+            groups.erase(key);
+        }
+    }
+
+public:
+    NetworkAggregates() {
+        pipeGroups[PipeGroupField::Network];
+        pipeGroups[PipeGroupField::Diameter];
+        pipeGroups[PipeGroupField::RepairStatus];
+        stationGroups[StationGroupField::Network];
+        stationGroups[StationGroupField::StationClass];
+    }
+
+    void updatePipe(const Pipe* before, const Pipe* after) {
+        for (auto& group : pipeGroups) {
+            if (before != nullptr) {
+                apply(group.second, pipeKey(group.first, *before), *before, -1);
+            }
+            if (after != nullptr) {
+                apply(group.second, pipeKey(group.first, *after), *after, 1);
+            }
+        }
+    }
+
+    void updateStation(const CompressorStation* before, const CompressorStation* after) {
+        for (auto& group : stationGroups) {
+            if (before != nullptr) {
+                apply(group.second, stationKey(group.first, *before), *before, -1);
+            }
+            if (after != nullptr) {
+                apply(group.second, stationKey(group.first, *after), *after, 1);
+            }
+        }
+    }
+
+    void rebuild(const PipeMap& pipes, const StationMap& stations) {
+        for (auto& group : pipeGroups) {
+            group.second.clear();
+            for (const auto& pair : pipes) {
+                apply(group.second, pipeKey(group.first, pair.second), pair.second, 1);
+            }
+        }
+        for (auto& group : stationGroups) {
+            group.second.clear();
+            for (const auto& pair : stations) {
+                apply(group.second, stationKey(group.first, pair.second), pair.second, 1);
+            }
+        }
+    }
+
+    const unordered_map<long long, PipeTotals>& pipesBy(PipeGroupField field, const PipeMap& pipes) {
+        auto it = pipeGroups.find(field);
+        if (it == pipeGroups.end()) {
+            it = pipeGroups.emplace(field, unordered_map<long long, PipeTotals>()).first;
+            for (const auto& pair : pipes) {
+                apply(it->second, pipeKey(field, pair.second), pair.second, 1);
+            }
+        }
+        return it->second;
+    }
+
+    const unordered_map<long long, StationTotals>& stationsBy(StationGroupField field, const StationMap& stations) {
+        auto it = stationGroups.find(field);
+        if (it == stationGroups.end()) {
+            it = stationGroups.emplace(field, unordered_map<long long, StationTotals>()).first;
+            for (const auto& pair : stations) {
+                apply(it->second, stationKey(field, pair.second), pair.second, 1);
+            }
+        }
+        return it->second;
+    }
+};
+
+struct StationPoint {
+    int id;
+    double x;
+    double y;
+};
+
+struct PipeSegment {
+    int id;
+    double startX;
+    double startY;
+    double endX;
+    double endY;
+};
+
+// Uniform grid over station locations and pipe geometry. A station is kept
+// in the cell containing it, a pipe in every cell its bounding box covers;
+// pipes spanning too many cells go to a separate list checked on each query.
+// Records without coordinates are not indexed.
+class SpatialIndex {
+private:
+    double cellSize;
+    unordered_map<int64_t, vector<StationPoint>> stationCells;
+    unordered_map<int64_t, vector<PipeSegment>> pipeCells;
+    vector<PipeSegment> widePipes;
+    size_t stationCount = 0;
+    int64_t minCellX = 0;
+    int64_t minCellY = 0;
+    int64_t maxCellX = -1;
+    int64_t maxCellY = -1;
+
+    // Input is range-checked where it is read; anything that still gets
+    // past it lands in the border cells instead of overflowing the cell key.
+    int64_t cellCoordinate(double value) const {
+        if (!isValidCoordinate(value)) {
+            value = isnan(value) ? 0.0 : copysign(SPATIAL_COORDINATE_LIMIT, value);
+        }
+        return static_cast<int64_t>(floor(value / cellSize));
+    }
+
+    static int64_t cellKey(int64_t cellX, int64_t cellY) {
+        return static_cast<int64_t>((static_cast<uint64_t>(cellX) << 32) ^ static_cast<uint32_t>(cellY));
+    }
+
+    static PipeSegment segmentOf(const Pipe& pipe) {
+        return { pipe.id, pipe.startX, pipe.startY, pipe.endX, pipe.endY };
+    }
+
+    static double squaredDistance(const StationPoint& point, double x, double y) {
+        return (point.x - x) * (point.x - x) + (point.y - y) * (point.y - y);
+    }
+
+    template<typename Entry>
+    static void removeEntry(vector<Entry>& entries, int id) {
+        for (size_t i = 0; i < entries.size(); i++) {
+            if (entries[i].id == id) {
+                entries[i] = entries.back();
+                entries.pop_back();
+                return;
+            }
+        }
+    }
+
+    // Visits every occupied cell overlapping the box, or every occupied cell
+    // when the box covers more cells than are occupied.
+    template<typename Entry, typename Visitor>
+    void visitCells(const unordered_map<int64_t, vector<Entry>>& cells, double minX, double minY, double maxX, double maxY, Visitor visit) const {
+        int64_t fromX = cellCoordinate(minX), toX = cellCoordinate(maxX);
+        int64_t fromY = cellCoordinate(minY), toY = cellCoordinate(maxY);
+        if (static_cast<double>(toX - fromX + 1) * static_cast<double>(toY - fromY + 1) > cells.size()) {
+            for (const auto& pair : cells) {
+                visit(pair.second);
+            }
+            return;
+        }
+
+        for (int64_t cellX = fromX; cellX <= toX; cellX++) {
+            for (int64_t cellY = fromY; cellY <= toY; cellY++) {
+                auto it = cells.find(cellKey(cellX, cellY));
+                if (it != cells.end()) {
+                    visit(it->second);
+                }
+            }
+        }
+    }
+
+    template<typename Action>
+    bool forEachPipeCell(const PipeSegment& segment, Action action) const {
+        int64_t fromX = cellCoordinate(min(segment.startX, segment.endX)), toX = cellCoordinate(max(segment.startX, segment.endX));
+        int64_t fromY = cellCoordinate(min(segment.startY, segment.endY)), toY = cellCoordinate(max(segment.startY, segment.endY));
+        if (static_cast<double>(toX - fromX + 1) * static_cast<double>(toY - fromY + 1) > SPATIAL_MAX_PIPE_CELLS) {
+            return false;
+        }
+        for (int64_t cellX = fromX; cellX <= toX; cellX++) {
+            for (int64_t cellY = fromY; cellY <= toY; cellY++) {
+                action(cellKey(cellX, cellY));
+            }
+        }
+        return true;
+    }
+
+    // Liang-Barsky clipping of the segment against the box.
+    static bool intersectsBox(const PipeSegment& segment, double minX, double minY, double maxX, double maxY) {
+        double dx = segment.endX - segment.startX;
+        double dy = segment.endY - segment.startY;
+        double enter = 0.0, leave = 1.0;
+        auto clip = [&](double direction, double distance) {
+            if (direction == 0.0) {
+                return distance >= 0.0;
+            }
+            double ratio = distance / direction;
+            if (direction < 0.0) {
+                if (ratio > leave) return false;
+                enter = max(enter, ratio);
+            } else {
+                if (ratio < enter) return false;
+                leave = min(leave, ratio);
+            }
+            return true;
+        };
+        return clip(-dx, segment.startX - minX) && clip(dx, maxX - segment.startX)
+            && clip(-dy, segment.startY - minY) && clip(dy, maxY - segment.startY);
+    }
+
+public:
+    explicit SpatialIndex(double cellSize = SPATIAL_CELL_SIZE) : cellSize(cellSize) {}
+
+    void insertStation(const CompressorStation& station) {
+        int64_t cellX = cellCoordinate(station.x), cellY = cellCoordinate(station.y);
+        stationCells[cellKey(cellX, cellY)].push_back({ station.id, station.x, station.y });
+        if (stationCount++ == 0) {
+            minCellX = maxCellX = cellX;
+            minCellY = maxCellY = cellY;
+        }
+        minCellX = min(minCellX, cellX);
+        maxCellX = max(maxCellX, cellX);
+        minCellY = min(minCellY, cellY);
+        maxCellY = max(maxCellY, cellY);
+    }
+
+    void removeStation(const CompressorStation& station) {
+        auto it = stationCells.find(cellKey(cellCoordinate(station.x), cellCoordinate(station.y)));
+        if (it == stationCells.end()) {
+            return;
+        }
+        size_t before = it->second.size();
+        removeEntry(it->second, station.id);
+        stationCount -= before - it->second.size();
+        if (it->second.empty()) {
+            stationCells.erase(it);
+        }
+    }
+
+    void insertPipe(const Pipe& pipe) {
+        PipeSegment segment = segmentOf(pipe);
+        if (!forEachPipeCell(segment, [&](int64_t key) { pipeCells[key].push_back(segment); })) {
+            widePipes.push_back(segment);
+        }
+    }
+
+    void removePipe(const Pipe& pipe) {
+        PipeSegment segment = segmentOf(pipe);
+        bool indexed = forEachPipeCell(segment, [&](int64_t key) {
+            auto it = pipeCells.find(key);
+            if (it != pipeCells.end()) {
+                removeEntry(it->second, pipe.id);
+                if (it->second.empty()) {
+                    pipeCells.erase(it);
+                }
+            }
+        });
+        if (!indexed) {
+            removeEntry(widePipes, pipe.id);
+        }
+    }
+
+    void updateStation(const CompressorStation* before, const CompressorStation* after) {
+        if (before != nullptr && after != nullptr && before->hasLocation() == after->hasLocation()
+            && before->x == after->x && before->y == after->y) {
+            return;
+        }
+        if (before != nullptr && before->hasLocation()) {
+            removeStation(*before);
+        }
+        if (after != nullptr && after->hasLocation()) {
+            insertStation(*after);
+        }
+    }
+
+    void updatePipe(const Pipe* before, const Pipe* after) {
+        if (before != nullptr && after != nullptr && before->hasGeometry() == after->hasGeometry()
+            && before->startX == after->startX && before->startY == after->startY
+            && before->endX == after->endX && before->endY == after->endY) {
+            return;
+        }
+        if (before != nullptr && before->hasGeometry()) {
+            removePipe(*before);
+        }
+        if (after != nullptr && after->hasGeometry()) {
+            insertPipe(*after);
+        }
+    }
+
+    void rebuild(const PipeMap& pipes, const StationMap& stations) {
+        stationCells.clear();
+        pipeCells.clear();
+        widePipes.clear();
+        stationCount = 0;
+        for (const auto& pair : stations) {
+            if (pair.second.hasLocation()) {
+                insertStation(pair.second);
+            }
+        }
+        for (const auto& pair : pipes) {
+            if (pair.second.hasGeometry()) {
+                insertPipe(pair.second);
+            }
+        }
+    }
+
+    size_t indexedStations() const {
+        return stationCount;
+    }
+
+    // (distance, station ID) pairs sorted by distance.
+    vector<pair<double, int>> stationsWithin(double x, double y, double radius) const {
+        vector<pair<double, int>> found;
+        double limit = radius * radius;
+        visitCells(stationCells, x - radius, y - radius, x + radius, y + radius, [&](const vector<StationPoint>& cell) {
+            for (const StationPoint& point : cell) {
+                double distance = squaredDistance(point, x, y);
+                if (distance <= limit) {
+                    found.emplace_back(distance, point.id);
+                }
+            }
+        });
+
+        sort(found.begin(), found.end());
+        for (auto& entry : found) {
+            entry.first = sqrt(entry.first);
+        }
+        return found;
+    }
+
+    // Searches rings of cells around the point until no unvisited cell can
+    // hold anything closer than the current k-th nearest station.
+    vector<pair<double, int>> nearestStations(double x, double y, size_t count) const {
+        vector<pair<double, int>> best;
+        if (count == 0 || stationCount == 0) {
+            return best;
+        }
+
+        auto consider = [&](const StationPoint& point) {
+            double distance = squaredDistance(point, x, y);
+            if (best.size() < count) {
+                best.emplace_back(distance, point.id);
+                push_heap(best.begin(), best.end());
+            } else if (distance < best.front().first) {
+                pop_heap(best.begin(), best.end());
+                best.back() = { distance, point.id };
+                push_heap(best.begin(), best.end());
+            }
+        };
+
+        int64_t centerX = cellCoordinate(x), centerY = cellCoordinate(y);
+        int64_t firstRing = max({ minCellX - centerX, centerX - maxCellX, minCellY - centerY, centerY - maxCellY, int64_t(0) });
+        int64_t lastRing = max({ abs(centerX - minCellX), abs(centerX - maxCellX), abs(centerY - minCellY), abs(centerY - maxCellY) });
+        size_t visitedCells = 0;
+        auto visitCell = [&](int64_t cellX, int64_t cellY) {
+            if (best.size() == count) {
+                double dx = max({ cellX * cellSize - x, x - (cellX + 1) * cellSize, 0.0 });
+                double dy = max({ cellY * cellSize - y, y - (cellY + 1) * cellSize, 0.0 });
+                if (dx * dx + dy * dy >= best.front().first) {
+                    return;
+                }
+            }
+            visitedCells++;
+            auto it = stationCells.find(cellKey(cellX, cellY));
+            if (it != stationCells.end()) {
+                for (const StationPoint& point : it->second) {
+                    consider(point);
+                }
+            }
+        };
+
+        // Rings start at the first one reaching occupied cells and are clipped to them.
+        for (int64_t ring = firstRing; ring <= lastRing; ring++) {
+            if (best.size() == count && ring > 0) {
+                double reach = (ring - 1) * cellSize;
+                if (reach * reach >= best.front().first) {
+                    break;
+                }
+            }
+            if (visitedCells > stationCells.size()) {
+                best.clear();
+                for (const auto& pair : stationCells) {
+                    for (const StationPoint& point : pair.second) {
+                        consider(point);
+                    }
+                }
+                break;
+            }
+
+            int64_t fromX = max(centerX - ring, minCellX), toX = min(centerX + ring, maxCellX);
+            int64_t fromY = max(centerY - ring + 1, minCellY), toY = min(centerY + ring - 1, maxCellY);
+            for (int64_t cellX = fromX; cellX <= toX; cellX++) {
+                if (centerY - ring >= minCellY) {
+                    visitCell(cellX, centerY - ring);
+                }
+                if (ring > 0 && centerY + ring <= maxCellY) {
+                    visitCell(cellX, centerY + ring);
+                }
+            }
+            for (int64_t cellY = fromY; cellY <= toY; cellY++) {
+                if (centerX - ring >= minCellX) {
+                    visitCell(centerX - ring, cellY);
+                }
+                if (centerX + ring <= maxCellX) {
+                    visitCell(centerX + ring, cellY);
+                }
+            }
+        }
+
+        sort_heap(best.begin(), best.end());
+        for (auto& entry : best) {
+            entry.first = sqrt(entry.first);
+        }
+        return best;
+    }
+
+    // IDs of pipes whose geometry crosses or lies inside the box, sorted.
+    vector<int> pipesInBox(double minX, double minY, double maxX, double maxY) const {
+        vector<int> found;
+        auto check = [&](const PipeSegment& segment) {
+            if (intersectsBox(segment, minX, minY, maxX, maxY)) {
+                found.push_back(segment.id);
+            }
+        };
+
+        visitCells(pipeCells, minX, minY, maxX, maxY, [&](const vector<PipeSegment>& cell) {
+            for (const PipeSegment& segment : cell) {
+                check(segment);
+            }
+        });
+        for (const PipeSegment& segment : widePipes) {
+            check(segment);
+        }
+
+        sort(found.begin(), found.end());
+        found.erase(unique(found.begin(), found.end()), found.end());
+        return found;
+    }
+};
+
+struct NetworkEdge {
+    int neighbor;
+    int pipeId;
+};
+
+// Stations joined by operational pipes, split into connected areas. Adding a
+// pipe merges areas (smaller into larger). Removing one only searches the
+// graph when it might be a bridge, and then a two-sided search stops as soon
+// as the smaller side is exhausted. Bridges and articulation stations are
+// recomputed on demand with Tarjan's algorithm.
+class NetworkConnectivity {
+private:
+    unordered_map<int, vector<NetworkEdge>> adjacency;
+    unordered_map<int, pair<int, int>> edgeEnds;
+    unordered_map<int, int> areaOf;
+    unordered_map<int, unordered_set<int>> areaMembers;
+    int nextArea = 1;
+    vector<int> isolatedAreas;
+
+    unordered_set<int> bridges;
+    vector<int> articulationStations;
+    bool analysisFresh = false;
+    bool bridgesComplete = false;
+
+    static bool carriesGas(const Pipe& pipe, const StationMap& stations) {
+        return !pipe.underRepair && pipe.startStationId != 0 && pipe.startStationId != pipe.endStationId
+            && stations.find(pipe.startStationId) != stations.end() && stations.find(pipe.endStationId) != stations.end();
+    }
+
+    static void removeEdgeFrom(vector<NetworkEdge>& edges, int pipeId) {
+        for (size_t i = 0; i < edges.size(); i++) {
+            if (edges[i].pipeId == pipeId) {
+                edges[i] = edges.back();
+                edges.pop_back();
+                return;
+            }
+        }
+    }
+
+    void moveToArea(int station, int area) {
+        areaMembers[areaOf[station]].erase(station);
+        areaOf[station] = area;
+        areaMembers[area].insert(station);
+    }
+
+    void addEdge(int pipeId, int start, int end) {
+        adjacency[start].push_back({ end, pipeId });
+        adjacency[end].push_back({ start, pipeId });
+        edgeEnds[pipeId] = { start, end };
+        analysisFresh = false;
+
+        int from = areaOf[start], to = areaOf[end];
+        if (from == to) {
+            return;
+        }
+        if (areaMembers[from].size() > areaMembers[to].size()) {
+            swap(from, to);
+        }
+        for (int station : areaMembers[from]) {
+            areaOf[station] = to;
+        }
+        areaMembers[to].insert(areaMembers[from].begin(), areaMembers[from].end());
+        areaMembers.erase(from);
+    }
+
+    void removeEdge(int pipeId) {
+        auto it = edgeEnds.find(pipeId);
+        int start = it->second.first, end = it->second.second;
+        edgeEnds.erase(it);
+        removeEdgeFrom(adjacency[start], pipeId);
+        removeEdgeFrom(adjacency[end], pipeId);
+
+        bool knownNonBridge = bridgesComplete && bridges.find(pipeId) == bridges.end();
+        analysisFresh = false;
+        bridgesComplete = false;
+        if (!knownNonBridge) {
+            splitIfDisconnected(start, end);
+        }
+    }
+
+    // Grows searches from both ends in turn; the side that runs out first
+    // without meeting the other becomes a new area.
+    void splitIfDisconnected(int first, int second) {
+        vector<int> visited[2] = { { first }, { second } };
+        unordered_set<int> seen[2] = { { first }, { second } };
+        size_t next[2] = { 0, 0 };
+
+        while (true) {
+            for (int side = 0; side < 2; side++) {
+                if (next[side] == visited[side].size()) {
+                    int area = nextArea++;
+                    for (int station : visited[side]) {
+                        moveToArea(station, area);
+                    }
+                    isolatedAreas.push_back(area);
+                    return;
+                }
+
+                int station = visited[side][next[side]++];
+                for (const NetworkEdge& edge : adjacency[station]) {
+                    if (seen[1 - side].count(edge.neighbor)) {
+                        return;
+                    }
+                    if (seen[side].insert(edge.neighbor).second) {
+                        visited[side].push_back(edge.neighbor);
+                    }
+                }
+            }
+        }
+    }
+
+public:
+    void addStation(int station) {
+        adjacency[station];
+        int area = nextArea++;
+        areaOf[station] = area;
+        areaMembers[area].insert(station);
+        analysisFresh = false;
+    }
+
+    // Every piece left behind except the largest is reported as isolated.
+    void removeStation(int station) {
+        vector<NetworkEdge> edges = adjacency[station];
+        size_t reported = isolatedAreas.size();
+        for (const NetworkEdge& edge : edges) {
+            removeEdge(edge.pipeId);
+        }
+        isolatedAreas.resize(reported);
+
+        auto area = areaMembers.find(areaOf[station]);
+        area->second.erase(station);
+        if (area->second.empty()) {
+            areaMembers.erase(area);
+        }
+        areaOf.erase(station);
+        adjacency.erase(station);
+        analysisFresh = false;
+
+        vector<int> pieces;
+        for (const NetworkEdge& edge : edges) {
+            pieces.push_back(areaOf[edge.neighbor]);
+        }
+        sort(pieces.begin(), pieces.end());
+        pieces.erase(unique(pieces.begin(), pieces.end()), pieces.end());
+        if (pieces.size() > 1) {
+            auto largest = max_element(pieces.begin(), pieces.end(), [this](int a, int b) {
+                return areaMembers[a].size() < areaMembers[b].size();
+            });
+            pieces.erase(largest);
+            isolatedAreas.insert(isolatedAreas.end(), pieces.begin(), pieces.end());
+        }
+    }
+
+    void updatePipe(const Pipe* before, const Pipe* after, const StationMap& stations) {
+        int pipeId = before != nullptr ? before->id : after->id;
+        bool wasEdge = edgeEnds.find(pipeId) != edgeEnds.end();
+        bool isEdge = after != nullptr && carriesGas(*after, stations);
+        if (wasEdge && isEdge && edgeEnds[pipeId] == make_pair(after->startStationId, after->endStationId)) {
+            return;
+        }
+        if (wasEdge) {
+            removeEdge(pipeId);
+        }
+        if (isEdge) {
+            addEdge(pipeId, after->startStationId, after->endStationId);
+        }
+    }
+
+    void updateStation(const CompressorStation* before, const CompressorStation* after) {
+        if (before == nullptr && after != nullptr) {
+            addStation(after->id);
+        } else if (before != nullptr && after == nullptr) {
+            removeStation(before->id);
+        }
+    }
+
+    void rebuild(const PipeMap& pipes, const StationMap& stations) {
+        adjacency.clear();
+        edgeEnds.clear();
+        areaOf.clear();
+        areaMembers.clear();
+        isolatedAreas.clear();
+        nextArea = 1;
+        for (const auto& pair : stations) {
+            addStation(pair.first);
+        }
+        for (const auto& pair : pipes) {
+            if (carriesGas(pair.second, stations)) {
+                addEdge(pair.first, pair.second.startStationId, pair.second.endStationId);
+            }
+        }
+    }
+
+    // Areas cut off since the last call that still exist, as sorted station IDs.
+    vector<vector<int>> takeIsolatedAreas() {
+        vector<vector<int>> result;
+        for (int area : isolatedAreas) {
+            auto it = areaMembers.find(area);
+            if (it != areaMembers.end() && !it->second.empty()) {
+                result.emplace_back(it->second.begin(), it->second.end());
+                sort(result.back().begin(), result.back().end());
+            }
+        }
+        isolatedAreas.clear();
+        return result;
+    }
+
+    // Area sizes, largest first.
+    vector<size_t> areaSizes() const {
+        vector<size_t> sizes;
+        for (const auto& pair : areaMembers) {
+            sizes.push_back(pair.second.size());
+        }
+        sort(sizes.rbegin(), sizes.rend());
+        return sizes;
+    }
+
+    bool analysisUpToDate() const {
+        return analysisFresh;
+    }
+
+    // Iterative Tarjan over all areas; parallel pipes are told apart by ID.
+    void analyze() {
+        vector<int> stationIds;
+        unordered_map<int, int> indexOf;
+        stationIds.reserve(adjacency.size());
+        for (const auto& pair : adjacency) {
+            indexOf[pair.first] = static_cast<int>(stationIds.size());
+            stationIds.push_back(pair.first);
+        }
+
+        size_t count = stationIds.size();
+        vector<const vector<NetworkEdge>*> edges(count);
+        for (size_t i = 0; i < count; i++) {
+            edges[i] = &adjacency.at(stationIds[i]);
+        }
+
+        struct Frame {
+            int station;
+            int parentPipe;
+            size_t next;
+        };
+
+        vector<int> discovered(count, -1), low(count, 0);
+        vector<char> articulation(count, 0);
+        vector<Frame> stack;
+        int timer = 0;
+        bridges.clear();
+
+        for (size_t root = 0; root < count; root++) {
+            if (discovered[root] >= 0) {
+                continue;
+            }
+            discovered[root] = low[root] = timer++;
+            stack.push_back({ static_cast<int>(root), -1, 0 });
+            int rootChildren = 0;
+
+            while (!stack.empty()) {
+                Frame& frame = stack.back();
+                int station = frame.station;
+                if (frame.next < edges[station]->size()) {
+                    const NetworkEdge& edge = (*edges[station])[frame.next++];
+                    if (edge.pipeId == frame.parentPipe) {
+                        continue;
+                    }
+                    int neighbor = indexOf[edge.neighbor];
+                    if (discovered[neighbor] < 0) {
+                        discovered[neighbor] = low[neighbor] = timer++;
+                        if (station == static_cast<int>(root)) {
+                            rootChildren++;
+                        }
+                        stack.push_back({ neighbor, edge.pipeId, 0 });
+                    } else {
+                        low[station] = min(low[station], discovered[neighbor]);
+                    }
+                    continue;
+                }
+
+                int parentPipe = frame.parentPipe;
+                stack.pop_back();
+                if (stack.empty()) {
+                    break;
+                }
+                int parent = stack.back().station;
+                low[parent] = min(low[parent], low[station]);
+                if (low[station] > discovered[parent]) {
+                    bridges.insert(parentPipe);
+                }
+                if (parent != static_cast<int>(root) && low[station] >= discovered[parent]) {
+                    articulation[parent] = 1;
+                }
+            }
+            if (rootChildren > 1) {
+                articulation[root] = 1;
+            }
+        }
+
+        articulationStations.clear();
+        for (size_t i = 0; i < count; i++) {
+            if (articulation[i]) {
+                articulationStations.push_back(stationIds[i]);
+            }
+        }
+        sort(articulationStations.begin(), articulationStations.end());
+        analysisFresh = true;
+        bridgesComplete = true;
+    }
+
+    vector<int> bridgePipes() const {
+        vector<int> result(bridges.begin(), bridges.end());
+        sort(result.begin(), result.end());
+        return result;
+    }
+
+    const vector<int>& articulationPoints() const {
+        return articulationStations;
+    }
+};
+
+class DataManager {
+private:
+    EntityStore<Pipe> pipes;
+    EntityStore<CompressorStation> stations;
+    string baseFilename = "";
+    int deltaCount = 0;
+    // Region that new pipes and stations take their IDs from.
+    int activeRegion = 0;
+
+    NetworkAggregates aggregates;
+    SpatialIndex spatial;
+    NetworkConnectivity connectivity;
+    EventHistory history;
+    VersionLog versions;
+
+    // Held by the menu loop except while it waits for input, and by
+    // replication while it reads or replaces the state.
+    mutex stateMutex;
+    ChangeFeed feed;
+    string feedPath = "";
+    bool feedToSocket = false;
+    ChangeFeed replicationFeed;
+    ReplicationServer* replicationServer = nullptr;
+    uint64_t replicationStart = 1;
+    unique_ptr<ReplicationFollower> follower;
+
+    void onRecordChanged(const Pipe* before, const Pipe* after) {
+        pipes.trackChange(before, after);
+        aggregates.updatePipe(before, after);
+        spatial.updatePipe(before, after);
+        connectivity.updatePipe(before, after, stations);
+        versions.recordPipe(before, after);
+        if (after != nullptr && (before == nullptr || before->underRepair != after->underRepair)) {
+            history.recordRepairStatus(*after);
+        }
+        if (feed.active()) {
+            feed.publishPipe(before, after);
+        }
+        if (replicationFeed.active()) {
+            replicationFeed.publishPipe(before, after);
+        }
+    }
+
+    void onRecordChanged(const CompressorStation* before, const CompressorStation* after) {
+        stations.trackChange(before, after);
+        aggregates.updateStation(before, after);
+        spatial.updateStation(before, after);
+        connectivity.updateStation(before, after);
+        versions.recordStation(before, after);
+        if (after != nullptr && (before == nullptr || before->activeWorkshops != after->activeWorkshops
+            || before->totalWorkshops != after->totalWorkshops)) {
+            history.recordWorkshops(*after);
+        }
+        if (feed.active()) {
+            feed.publishStation(before, after);
+        }
+        if (replicationFeed.active()) {
+            replicationFeed.publishStation(before, after);
+        }
+    }
+
+    void onDataReloaded() {
+        clearChanges();
+        pipes.invalidateIndexes();
+        stations.invalidateIndexes();
+        aggregates.rebuild(pipes, stations);
+        spatial.rebuild(pipes, stations);
+        connectivity.rebuild(pipes, stations);
+        versions.reset();
+        if (feed.active()) {
+            feed.publishReset();
+        }
+        if (replicationFeed.active()) {
+            replicationFeed.publishReset();
+        }
+    }
+
+    void clearChanges() {
+        pipes.clearChanges();
+        stations.clearChanges();
+    }
+
+    bool hasChanges() const {
+        return pipes.hasChanges() || stations.hasChanges();
+    }
+
+    static string deltaFilename(const string& filename, int index) {
+        return filename + ".delta" + to_string(index) + ".txt";
+    }
+
+    // The name of a file without its directory, so the same save opened by
+    // another path still matches the names recorded in it.
+    static string fileNameOf(const string& path) {
+        size_t separator = path.find_last_of("/\\");
+        return separator == string::npos ? path : path.substr(separator + 1);
+    }
+
+    static string directoryOf(const string& path) {
+        size_t separator = path.find_last_of("/\\");
+        return separator == string::npos ? "" : path.substr(0, separator + 1);
+    }
+
+    static string shardFilename(const string& filename, int index) {
+        return filename + ".shard" + to_string(index) + ".txt";
+    }
+
+    bool writeShardFile(const string& path, int index) const {
+        FileOutput outFile(path);
+        if (!outFile) {
+            return false;
+        }
+
+        pipes.writeShard(outFile, index);
+        stations.writeShard(outFile, index);
+
+        outFile.close();
+        return !outFile.fail();
+    }
+
+    static bool readShardFile(const string& path, PipeMap::Shard& pipeShard, StationMap::Shard& stationShard) {
+        FileInput inFile(path);
+        if (!inFile) {
+            return false;
+        }
+
+        string line;
+        while (getline(inFile, line)) {
+            if (!EntityStore<Pipe>::readShardRecord(line, inFile, pipeShard)) {
+                EntityStore<CompressorStation>::readShardRecord(line, inFile, stationShard);
+            }
+        }
+        return !inFile.readFailed();
+    }
+
+    bool readShardFiles(const vector<pair<int, string>>& shardFiles) {
+        vector<PipeMap::Shard> pipeShards(shardFiles.size());
+        vector<StationMap::Shard> stationShards(shardFiles.size());
+        vector<char> loaded(shardFiles.size(), 0);
+        parallelFor(shardFiles.size(), [&](size_t i) {
+            loaded[i] = readShardFile(shardFiles[i].second, pipeShards[i], stationShards[i]);
+        });
+
+        bool success = true;
+        for (size_t i = 0; i < shardFiles.size(); i++) {
+            pipes.adopt(move(pipeShards[i]));
+            stations.adopt(move(stationShards[i]));
+            if (!loaded[i]) {
+                cout << "Warning: Could not read shard file " << shardFiles[i].second << "\n";
+                success = false;
+            }
+        }
+        return success;
+    }
+
+    // Shard indexes the existing save lists, read before it is overwritten.
+    static vector<int> listedShards(const string& path) {
+        ifstream inFile(path);
+        vector<int> indexes;
+        string line;
+        while (getline(inFile, line)) {
+            if (line == SHARD_IDENTIFIER && getline(inFile, line)) {
+                indexes.push_back(atoi(line.c_str()));
+            }
+        }
+        return indexes;
+    }
+
+    bool writeFullSnapshot(const string& filename) {
+        vector<int> previousShards = listedShards(filename + ".txt");
+        FileOutput outFile(filename + ".txt");
+        if (!outFile) {
+            cout << "Error: Could not create file " << filename << ".txt" << endl;
+            return false;
+        }
+
+        pipes.writeIdHeader(outFile);
+        stations.writeIdHeader(outFile);
+
+        vector<int> shardIndexes = pipes.shardIndexes();
+        vector<int> stationShardIndexes = stations.shardIndexes();
+        shardIndexes.insert(shardIndexes.end(), stationShardIndexes.begin(), stationShardIndexes.end());
+        sort(shardIndexes.begin(), shardIndexes.end());
+        shardIndexes.erase(unique(shardIndexes.begin(), shardIndexes.end()), shardIndexes.end());
+
+        for (int index : shardIndexes) {
+            outFile << SHARD_IDENTIFIER << "\n" << index << " " << shardFilename(fileNameOf(filename), index) << "\n";
+        }
+
+        outFile.close();
+        if (!outFile) {
+            cout << "Error: Could not write file " << filename << ".txt" << endl;
+            return false;
+        }
+
+        vector<char> written(shardIndexes.size(), 0);
+        parallelFor(shardIndexes.size(), [&](size_t i) {
+            written[i] = writeShardFile(shardFilename(filename, shardIndexes[i]), shardIndexes[i]);
+        });
+        for (size_t i = 0; i < shardIndexes.size(); i++) {
+            if (!written[i]) {
+                cout << "Error: Could not write file " << shardFilename(filename, shardIndexes[i]) << endl;
+                return false;
+            }
+        }
+
+        for (int index : previousShards) {
+            if (!binary_search(shardIndexes.begin(), shardIndexes.end(), index)) {
+                remove(shardFilename(filename, index).c_str());
+            }
+        }
+        for (int index = 1; remove(deltaFilename(filename, index).c_str()) == 0; index++) {
+        }
+
+        baseFilename = filename;
+        deltaCount = 0;
+        clearChanges();
+        return true;
+    }
+
+    bool writeDelta(const string& filename) {
+        string deltaName = deltaFilename(filename, deltaCount + 1);
+        FileOutput outFile(deltaName);
+        if (!outFile) {
+            cout << "Error: Could not create file " << deltaName << endl;
+            return false;
+        }
+
+        outFile << DELTA_BASE_IDENTIFIER << "\n" << fileNameOf(filename) << ".txt\n";
+        pipes.writeChanges(outFile);
+        stations.writeChanges(outFile);
+
+        outFile.close();
+        if (!outFile) {
+            cout << "Error: Could not write file " << deltaName << endl;
+            return false;
+        }
+
+        deltaCount++;
+        clearChanges();
+        return true;
+    }
+
+    // Returns false when the file is missing or belongs to another base;
+    // `damaged` is set when it exists but could not be read completely.
+    bool readDataFile(const string& path, const string& expectedBase, bool& damaged) {
+        FileInput inFile(path);
+        if (!inFile) {
+            return false;
+        }
+
+        string line;
+        // A delta records its base on the first line, so one without it is
+        // rejected before any of its changes are applied.
+        if (!expectedBase.empty()) {
+            if (!getline(inFile, line) || line != DELTA_BASE_IDENTIFIER) {
+                cout << "Warning: " << path << " does not name its base file, skipping it.\n";
+                return false;
+            }
+            string base;
+            getline(inFile, base);
+            if (fileNameOf(base) != fileNameOf(expectedBase)) {
+                cout << "Warning: " << path << " belongs to " << base << ", skipping it.\n";
+                return false;
+            }
+        }
+
+        vector<pair<int, string>> shardFiles;
+        while (getline(inFile, line)) {
+            if (line == SHARD_IDENTIFIER) {
+                getline(inFile, line);
+                size_t separator = line.find(' ');
+                if (separator != string::npos) {
+                    // Shards sit next to the file that lists them.
+                    shardFiles.emplace_back(atoi(line.c_str()), directoryOf(path) + fileNameOf(line.substr(separator + 1)));
+                }
+            }
+            else if (line == DELTA_BASE_IDENTIFIER) {
+                string base;
+                getline(inFile, base);
+                if (fileNameOf(base) != fileNameOf(expectedBase)) {
+                    cout << "Warning: " << path << " belongs to " << base << ", skipping it.\n";
+                    return false;
+                }
+            }
+            else if (!pipes.readSection(line, inFile)) {
+                stations.readSection(line, inFile);
+            }
+        }
+
+        if (inFile.readFailed()) {
+            cout << "Error: Could not read " << path << "\n";
+            damaged = true;
+        }
+        damaged |= !readShardFiles(shardFiles);
+        return !damaged;
+    }
+
+    // Reads into empty stores and puts the current ones back unless the base
+    // and all of its deltas load, so a failed load leaves the data as it was.
+    bool readSnapshot(const string& filename) {
+        EntityStore<Pipe> previousPipes = move(pipes);
+        EntityStore<CompressorStation> previousStations = move(stations);
+        pipes = EntityStore<Pipe>();
+        stations = EntityStore<CompressorStation>();
+
+        bool damaged = false;
+        bool loaded = readDataFile(filename + ".txt", "", damaged);
+        int deltas = 0;
+        while (loaded && readDataFile(deltaFilename(filename, deltas + 1), filename + ".txt", damaged)) {
+            deltas++;
+        }
+        if (!loaded || damaged) {
+            pipes = move(previousPipes);
+            stations = move(previousStations);
+            return false;
+        }
+
+        baseFilename = filename;
+        deltaCount = deltas;
+        onDataReloaded();
+        return true;
+    }
+
+    static vector<int> sortedIds(const unordered_set<int>& ids) {
+        vector<int> result(ids.begin(), ids.end());
+        sort(result.begin(), result.end());
+        return result;
+    }
+
+    vector<uint8_t> encodeColumnarSnapshot() {
+        ByteWriter writer;
+        writer.putBytes(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+        writer.putSigned(pipes.nextId);
+        writer.putSigned(stations.nextId);
+        writer.putSortedIds(sortedIds(pipes.usedIds));
+        writer.putSortedIds(sortedIds(stations.usedIds));
+        putRegionNextIds(writer, pipes.regionNextIds);
+        putRegionNextIds(writer, stations.regionNextIds);
+        pipes.encodeColumns(writer);
+        stations.encodeColumns(writer);
+        return writer.data();
+    }
+
+    static void putRegionNextIds(ByteWriter& writer, const map<int, int>& regionNextIds) {
+        writer.putVarint(regionNextIds.size());
+        for (const auto& pair : regionNextIds) {
+            writer.putSigned(pair.first);
+            writer.putSigned(pair.second);
+        }
+    }
+
+    // Regions were added in version 6.
+    static bool getRegionNextIds(ByteReader& reader, int version, map<int, int>& regionNextIds) {
+        uint64_t count = version < 6 ? 0 : reader.getVarint();
+        for (uint64_t i = 0; i < count && reader.ok(); i++) {
+            int64_t region = reader.getSigned();
+            int64_t next = reader.getSigned();
+            if (region <= 0 || region >= REGION_COUNT) {
+                return false;
+            }
+            regionNextIds[static_cast<int>(region)] = static_cast<int>(next);
+        }
+        return reader.ok();
+    }
+
+    // Counters missing from the source are raised past every used ID.
+    template<typename T>
+    static void restoreStore(EntityStore<T>& store, int64_t nextId, const map<int, int>& regionNextIds,
+        const vector<int>& usedIds, vector<T>& records) {
+        store.reset();
+        store.nextId = static_cast<int>(nextId);
+        store.regionNextIds = regionNextIds;
+        for (int id : usedIds) {
+            store.noteUsedId(id);
+        }
+        for (T& record : records) {
+            int id = record.id;
+            store[id] = move(record);
+        }
+    }
+
+    bool decodeColumnarSnapshot(const vector<uint8_t>& bytes) {
+        ByteReader reader(bytes.data(), bytes.size());
+        char magic[sizeof(SNAPSHOT_MAGIC)];
+        if (!reader.getBytes(magic, sizeof(magic)) || !equal(magic, magic + 3, SNAPSHOT_MAGIC)
+            || magic[3] < '1' || magic[3] > SNAPSHOT_MAGIC[3]) {
+            return false;
+        }
+        int version = magic[3] - '0';
+
+        int64_t nextPipe = reader.getSigned();
+        int64_t nextStation = reader.getSigned();
+        vector<int> usedPipes, usedStations;
+        reader.getSortedIds(usedPipes);
+        reader.getSortedIds(usedStations);
+        map<int, int> pipeRegions, stationRegions;
+        if (!getRegionNextIds(reader, version, pipeRegions) || !getRegionNextIds(reader, version, stationRegions)) {
+            return false;
+        }
+
+        vector<Pipe> pipeRecords;
+        vector<CompressorStation> stationRecords;
+        if (!EntityStore<Pipe>::decodeColumns(reader, version, pipeRecords)
+            || !EntityStore<CompressorStation>::decodeColumns(reader, version, stationRecords)) {
+            return false;
+        }
+
+        restoreStore(pipes, nextPipe, pipeRegions, usedPipes, pipeRecords);
+        restoreStore(stations, nextStation, stationRegions, usedStations, stationRecords);
+        onDataReloaded();
+        return true;
+    }
+
+public:
+    template<typename T>
+    T getValidatedNumber(const string& prompt, T minValue = 1, T maxValue = numeric_limits<T>::max()) {
+        string input;
+        T value;
+
+        while (true) {
+            cout << prompt;
+            getline(cin, input);
+
+            stringstream ss(input);
+
+            if (ss >> value) {
+                char remaining;
+                if (ss >> remaining) {
+                    cout << "Invalid input! Please enter only a number without extra characters.\n";
+                    continue;
+                }
+
+                if (value < minValue  value > maxValue) {
+                    cout << "Invalid input! Please enter a number between " << minValue << " and " << maxValue << ".\n";
+                    continue;
+                }
+
+                return value;
+            }
+            else {
+                cout << "Invalid input! Please enter a valid number.\n";
+            }
+        }
+    }
+
+    double getValidatedDouble(const string& prompt, double minValue = 0.0, double maxValue = 100.0) {
+        string input;
+        double value;
+
+        while (true) {
+            cout << prompt;
+            getline(cin, input);
+
+            stringstream ss(input);
+
+            if (ss >> value) {
+                char remaining;
+                if (ss >> remaining) {
+                    cout << "Invalid input! Please enter only a number without extra characters.\n";
+                    continue;
+                }
+
+                if (value < minValue  value > maxValue) {
+                    cout << "Invalid input! Please enter a number between " << minValue << " and " << maxValue << ".\n";
+                    continue;
+                }
+
+                return value;
+            }
+            else {
+                cout << "Invalid input! Please enter a valid number.\n";
+            }
+        }
+    }
+
+    bool getConfirmation(const string& message) {
+        string input;
+        while (true) {
+            cout << message << " (y/n): ";
+            getline(cin, input);
+
+            if (input == "y"  input == "Y") {
+                return true;
+            }
+            else if (input == "n"  input == "N") {
+                return false;
+            }
+            else {
+                cout << "Invalid input! Please enter 'y' or 'n'.\n";
+            }
+        }
+    }
+    template<typename T>
+    void displayAll(const EntityStore<T>& store) {
+        if (store.empty()) {
+            cout << "No " << EntityTraits<T>::plural << " available.\n";
+            return;
+        }
+
+        OutputBuffer out(cout);
+        out << "\n=== ALL " << EntityTraits<T>::title << " ===\n";
+        for (const auto& pair : store) {
+            out << pair.second;
+        }
+    }
+
+    // Records are looked up when their page is shown: on a follower,
+    // replication may change them while the user is choosing a page.
+    template<typename T>
+    void displayPage(const EntityStore<T>& store, const vector<int>& sorted, const PageRequest& page, const string& title) {
+        size_t first = min(page.offset, sorted.size());
+        size_t last = min(first + page.limit, sorted.size());
+
+        OutputBuffer out(cout);
+        out << "\n=== " << title << " " << (sorted.empty() ? 0 : first + 1) << "-" << last
+            << " OF " << sorted.size() << " ===\n";
+        for (size_t i = first; i < last; i++) {
+            auto it = store.find(sorted[i]);
+            if (it != store.end()) {
+                out << it->second;
+            }
+        }
+    }
+
+    template<typename T>
+    void browsePages(const EntityStore<T>& store, const vector<int>& sorted, PageRequest page, const string& title) {
+        while (true) {
+            displayPage(store, sorted, page, title);
+
+            bool hasPrevious = page.offset > 0;
+            bool hasNext = page.offset + page.limit < sorted.size();
+            if (!hasPrevious && !hasNext) {
+                return;
+            }
+
+            cout << (hasNext ? "n - next page, " : "") << (hasPrevious ? "p - previous page, " : "")
+                << "g - go to position, q - quit: ";
+            string input;
+            getline(cin, input);
+
+            if (input == "n" && hasNext) {
+                page.offset += page.limit;
+            }
+            else if (input == "p" && hasPrevious) {
+                page.offset -= min(page.offset, page.limit);
+            }
+            else if (input == "g") {
+                page.offset = getValidatedNumber<size_t>("Enter position: ", 1, sorted.size()) - 1;
+            }
+            else if (input == "q" || !cin) {
+                return;
+            }
+            else {
+                cout << "Invalid input!\n";
+            }
+        }
+    }
+
+    PageRequest getPageRequest(size_t total) {
+        PageRequest page;
+        page.descending = getValidatedNumber("Order (1 - ascending, 2 - descending): ", 1, 2) == 2;
+        page.limit = getValidatedNumber<size_t>("Records per page: ", 1);
+        page.offset = getValidatedNumber<size_t>("Start from position: ", 1, max<size_t>(total, 1)) - 1;
+        return page;
+    }
+
+    template<typename T>
+    void browse(const EntityStore<T>& store, const vector<int>& ids, const string& title = EntityTraits<T>::title) {
+        cout << "Sort " << EntityTraits<T>::plural << " by:\n";
+        cout << EntityStore<T>::sortFieldMenu();
+        size_t field = getValidatedNumber<size_t>("Choose field: ", 1, EntityStore<T>::sortFieldCount);
+        PageRequest page = getPageRequest(ids.size());
+
+        vector<int> sorted;
+        for (const T* record : store.sortedBy(ids, field - 1, page.descending)) {
+            sorted.push_back(record->id);
+        }
+        browsePages(store, sorted, page, title);
+    }
+
+    void browseObjectsMenu() {
+        cout << "\n=== BROWSE OBJECTS ===\n";
+        cout << "1. Pipes\n";
+        cout << "2. Compressor stations\n";
+        cout << "0. Back to main menu\n";
+
+        int choice = getValidatedNumber("Choose object type: ", 0, 2);
+
+        switch (choice) {
+            case 1:
+                if (pipes.empty()) {
+                    cout << "No pipes available.\n";
+                    return;
+                }
+                browse(pipes, pipes.allIds());
+                break;
+            case 2:
+                if (stations.empty()) {
+                    cout << "No stations available.\n";
+                    return;
+                }
+                browse(stations, stations.allIds());
+                break;
+            case 0:
+                return;
+        }
+    }
+
+    template<typename T>
+    void displayByIds(const EntityStore<T>& store, const vector<int>& ids) {
+        if (ids.empty()) {
+            cout << "No " << EntityTraits<T>::plural << " to display.\n";
+            return;
+        }
+
+        OutputBuffer out(cout);
+        out << "\n=== FOUND " << EntityTraits<T>::title << " ===\n";
+        for (int id : ids) {
+            auto it = store.find(id);
+            if (it != store.end()) {
+                out << it->second;
+            }
+        }
+        out << "Total found: " << ids.size() << " " << EntityTraits<T>::singular << "(s)\n";
+    }
+
+    template<typename T>
+    void displayFound(const EntityStore<T>& store, const vector<int>& ids) {
+        if (ids.size() > DEFAULT_PAGE_SIZE && getConfirmation("Found " + to_string(ids.size()) + " " + EntityTraits<T>::plural + ". Browse page by page?")) {
+            browse(store, ids);
+            return;
+        }
+        displayByIds(store, ids);
+    }
+
+    template<typename T>
+    size_t removeRecords(EntityStore<T>& store, const vector<int>& ids) {
+        size_t removedCount = 0;
+        for (int id : ids) {
+            auto it = store.find(id);
+            if (it == store.end()) {
+                continue;
+            }
+            T removed = move(it->second);
+            store.erase(it);
+            store.releaseId(id);
+            onRecordChanged(&removed, nullptr);
+            removedCount++;
+        }
+        return removedCount;
+    }
+
+    void searchPipesByName() {
+        if (pipes.empty()) {
+            cout << "No pipes available to search!\n";
+            return;
+        }
+
+        string searchName;
+        cout << "Enter pipe name to search for: ";
+        getline(cin, searchName);
+        
+        vector<int> foundIds = pipes.findByName(searchName);
+        
+        if (foundIds.empty()) {
+            cout << "No pipes found with name containing: " << searchName << "\n";
+            return;
+        }
+        
+        displayFound(pipes, foundIds);
+    }
+
+    void searchPipesByRepairStatus() {
+        if (pipes.empty()) {
+            cout << "No pipes available to search!\n";
+            return;
+        }
+
+        cout << "Search for pipes:\n";
+        cout << "1. Under repair\n";
+        cout << "2. Operational\n";
+        int choice = getValidatedNumber("Choose status: ", 1, 2);
+        
+        bool searchStatus = (choice == 1);
+        vector<int> foundIds = pipes.findEqual(&Pipe::underRepair, searchStatus);
+        
+        if (foundIds.empty()) {
+            cout << "No pipes found with the selected status.\n";
+            return;
+        }
+        
+        displayFound(pipes, foundIds);
+    }
+
+    void batchEditPipes() {
+        if (pipes.empty()) {
+            cout << "No pipes available to edit!\n";
+            return;
+        }
+cout << "\n=== BATCH PIPE EDITING ===\n";
+        cout << "1. Search by name\n";
+        cout << "2. Search by repair status\n";
+        cout << "0. Back to main menu\n";
+        
+        int choice = getValidatedNumber("Choose search type: ", 0, 2);
+        
+        vector<int> foundIds;
+        
+        switch (choice) {
+            case 1: {
+                string searchName;
+                cout << "Enter pipe name to search for: ";
+                getline(cin, searchName);
+                foundIds = pipes.findByName(searchName);
+                break;
+            }
+            case 2: {
+                cout << "Search for pipes:\n";
+                cout << "1. Under repair\n";
+                cout << "2. Operational\n";
+                int statusChoice = getValidatedNumber("Choose status: ", 1, 2);
+                foundIds = pipes.findEqual(&Pipe::underRepair, statusChoice == 1);
+                break;
+            }
+            case 0:
+                return;
+        }
+        
+        if (foundIds.empty()) {
+            cout << "No pipes found with the selected criteria.\n";
+            return;
+        }
+        
+        displayByIds(pipes, foundIds);
+        
+        cout << "\nBatch editing options:\n";
+        cout << "1. Edit all found pipes\n";
+        cout << "2. Select specific pipes to edit\n";
+        cout << "0. Cancel\n";
+        
+        int editChoice = getValidatedNumber("Choose editing mode: ", 0, 2);
+        
+        if (editChoice == 0) {
+            return;
+        }
+        
+        vector<int> pipesToEdit;
+        
+        if (editChoice == 1) {
+            pipesToEdit = foundIds;
+            cout << "Selected all " << foundIds.size() << " pipes for editing.\n";
+        } else if (editChoice == 2) {
+            cout << "Enter pipe IDs to edit (separated by spaces): ";
+            string input;
+            getline(cin, input);
+            
+            stringstream ss(input);
+            int id;
+            set<int> selectedIds;
+            
+            while (ss >> id) {
+                if (find(foundIds.begin(), foundIds.end(), id) != foundIds.end()) {
+                    selectedIds.insert(id);
+                } else {
+                    cout << "Pipe ID " << id << " not found in search results. Skipping.\n";
+                }
+            }
+            
+            if (selectedIds.empty()) {
+                cout << "No valid pipe IDs selected.\n";
+                return;
+            }
+            
+            pipesToEdit.assign(selectedIds.begin(), selectedIds.end());
+            cout << "Selected " << pipesToEdit.size() << " pipes for editing.\n";
+        }
+        
+        cout << "\nChoose editing action:\n";
+        cout << "1. Mark as under repair\n";
+        cout << "2. Mark as operational\n";
+        cout << "3. Toggle repair status (swap current status)\n";
+        
+        int action = getValidatedNumber("Choose action: ", 1, 3);
+        
+        map<int, vector<int>> groups = pipes.groupByShard(pipesToEdit);
+        vector<pair<PipeMap::Shard*, const vector<int>*>> work;
+        for (const auto& group : groups) {
+            work.emplace_back(&pipes.shard(group.first), &group.second);
+        }
+
+        vector<vector<pair<Pipe, Pipe*>>> changes(work.size());
+        parallelFor(work.size(), [&](size_t index) {
+            PipeMap::Shard& shard = *work[index].first;
+            for (int id : *work[index].second) {
+                auto it = shard.find(id);
+                if (it == shard.end()) {
+                    continue;
+                }
+
+                Pipe& pipe = it->second;
+                Pipe before = pipe;
+
+                switch (action) {
+                    case 1:
+                        pipe.underRepair = true;
+                        break;
+                    case 2:
+                        pipe.underRepair = false;
+                        break;
+                    case 3:
+                        pipe.underRepair = !pipe.underRepair;
+                        break;
+                }
+
+                if (before.underRepair != pipe.underRepair) {
+                    changes[index].emplace_back(move(before), &pipe);
+                }
+            }
+        });
+
+        int changedCount = 0;
+        for (const auto& shardChanges : changes) {
+            for (const auto& change : shardChanges) {
+                onRecordChanged(&change.first, change.second);
+                changedCount++;
+            }
+        }
+        
+        cout << "Successfully updated repair status for " << changedCount << " pipes.\n";
+        
+        if (getConfirmation("Show updated pipes?")) {
+            displayByIds(pipes, pipesToEdit);
+        }
+    }
+
+    void batchDeletePipes() {
+        if (pipes.empty()) {
+            cout << "No pipes available to delete!\n";
+            return;
+        }
+cout << "\n=== BATCH PIPE DELETION ===\n";
+        cout << "1. Search by name\n";
+        cout << "2. Search by repair status\n";
+        cout << "0. Back to main menu\n";
+        
         int choice = getValidatedNumber("Choose search type: ", 0, 2);
         
         vector<int> foundIds;
@@ -276,595 +6721,1603 @@ cout << "\n=== BATCH PIPE EDITING ===\n";
                 string searchName;
                 cout << "Enter pipe name to search for: ";
                 getline(cin, searchName);
-                foundIds = findPipesByName(searchName);
+                foundIds = pipes.findByName(searchName);
+                break;
+            }
+            case 2: {
+                cout << "Search for pipes:\n";
+                cout << "1. Under repair\n";
+                cout << "2. Operational\n";
+                int statusChoice = getValidatedNumber("Choose status: ", 1, 2);
+                foundIds = pipes.findEqual(&Pipe::underRepair, statusChoice == 1);
+                break;
+            }
+            case 0:
+                return;
+        }
+        
+        if (foundIds.empty()) {
+            cout << "No pipes found with the selected criteria.\n";
+            return;
+        }
+        
+        displayByIds(pipes, foundIds);
+        
+        if (getConfirmation("Delete all these pipes?")) {
+            cout << "Successfully deleted " << removeRecords(pipes, foundIds) << " pipes.\n";
+        }
+    }
+
+    void batchDeleteStations() {
+        if (stations.empty()) {
+            cout << "No stations available to delete!\n";
+            return;
+        }
+
+        cout << "\n=== BATCH STATION DELETION ===\n";
+        vector<int> foundIds = findStationsByName();
+        
+        if (foundIds.empty()) {
+            cout << "No stations found with the specified name.\n";
+            return;
+        }
+        
+        displayByIds(stations, foundIds);
+        
+        if (getConfirmation("Delete all these stations?")) {
+            cout << "Successfully deleted " << removeRecords(stations, foundIds) << " stations.\n";
+        }
+    }
+
+    void searchPipesMenu() {
+        if (pipes.empty()) {
+            cout << "No pipes available to search!\n";
+            return;
+        }
+
+        cout << "\n=== PIPE SEARCH ===\n";
+        cout << "1. Search by name\n";
+        cout << "2. Search by repair status\n";
+        cout << "0. Back to main menu\n";
+        
+        int choice = getValidatedNumber("Choose search type: ", 0, 2);
+        
+        switch (choice) {
+            case 1:
+                searchPipesByName();
+                break;
+            case 2:
+                searchPipesByRepairStatus();
+                break;
+            case 0:
+                return;
+        }
+    }
+
+    vector<int> findStationsByName() {
+        vector<int> foundIds;
+        if (stations.empty()) {
+            return foundIds;
+        }
+
+        string searchName;
+        cout << "Enter station name to search for: ";
+        getline(cin, searchName);
+        
+        return stations.findByName(searchName);
+    }
+
+    void searchStationsByName() {
+        if (stations.empty()) {
+            cout << "No stations available to search!\n";
+            return;
+        }
+vector<int> foundIds = findStationsByName();
+        
+        if (foundIds.empty()) {
+            cout << "No stations found with the specified name.\n";
+            return;
+        }
+        
+        displayFound(stations, foundIds);
+    }
+
+    static bool hasUnusedPercentage(const CompressorStation& station, double minPercentage, double maxPercentage) {
+        if (station.totalWorkshops == 0) {
+            return false;
+        }
+        double unusedPercentage = (1.0 - (double)station.activeWorkshops / station.totalWorkshops) * 100.0;
+        return unusedPercentage >= minPercentage && unusedPercentage <= maxPercentage;
+    }
+
+    void searchStationsByUnusedPercentage() {
+        if (stations.empty()) {
+            cout << "No stations available to search!\n";
+            return;
+        }
+
+        cout << "Search stations by percentage of unused workshops (0-100%)\n";
+        double minPercentage = getValidatedDouble("Enter minimum percentage: ", 0.0, 100.0);
+        double maxPercentage = getValidatedDouble("Enter maximum percentage: ", minPercentage, 100.0);
+        
+        vector<int> foundIds = stations.collectIds([minPercentage, maxPercentage](const CompressorStation& station) {
+            return hasUnusedPercentage(station, minPercentage, maxPercentage);
+        });
+        
+        if (foundIds.empty()) {
+            cout << "No stations found with unused workshops percentage between " 
+                 << minPercentage << "% and " << maxPercentage << "%\n";
+            return;
+        }
+        
+        OutputBuffer out(cout);
+        out << "\n=== FOUND STATIONS ===\n";
+        for (int id : foundIds) {
+            auto it = stations.find(id);
+            if (it != stations.end()) {
+                const CompressorStation& station = it->second;
+                double unusedPercentage = (1.0 - (double)station.activeWorkshops / station.totalWorkshops) * 100.0;
+                
+                out << "ID: " << station.id
+                    << " | Name: " << station.name
+                    << " | Workshops: " << station.activeWorkshops << "/" << station.totalWorkshops
+                    << " | Unused: " << unusedPercentage << "%"
+                    << " | Class: " << station.stationClass << "\n";
+            }
+        }
+        out << "Total found: " << foundIds.size() << " station(s)\n";
+    }
+
+    void searchStationsMenu() {
+        if (stations.empty()) {
+            cout << "No stations available to search!\n";
+            return;
+        }
+
+        cout << "\n=== STATION SEARCH ===\n";
+        cout << "1. Search by name\n";
+        cout << "2. Search by percentage of unused workshops\n";
+        cout << "0. Back to main menu\n";
+        
+        int choice = getValidatedNumber("Choose search type: ", 0, 2);
+        
+        switch (choice) {
+            case 1:
+                searchStationsByName();
+                break;
+            case 2:
+                searchStationsByUnusedPercentage();
                 break;
+            case 0:
+                return;
+        }
+    }
+
+    template<typename T>
+    void addRecord(EntityStore<T>& store) {
+        T newRecord;
+        newRecord.id = store.generateId(activeRegion);
+        if (newRecord.id == 0) {
+            cout << "Region " << activeRegion << " has no free " << EntityTraits<T>::singular << " IDs left!\n";
+            return;
+        }
+
+        cout << "Enter " << EntityTraits<T>::singular << " data:\n";
+        cin >> newRecord;
+
+        store[newRecord.id] = newRecord;
+        onRecordChanged(nullptr, &newRecord);
+        cout << EntityTraits<T>::typeName << " added successfully! (ID: " << newRecord.id << ")\n";
+    }
+
+    void editPipeStatus() {
+        if (pipes.empty()) {
+            cout << "No pipes available to edit!\n";
+            return;
+        }
+        displayAll(pipes);
+        int pipeId = getValidatedNumber<int>("\nEnter pipe ID to edit: ");
+        
+        auto it = pipes.find(pipeId);
+        if (it == pipes.end()) {
+            cout << "Pipe with ID " << pipeId << " not found!\n";
+            return;
+        }
+
+        Pipe& pipe = it->second;
+        cout << "Current repair status: " << (pipe.underRepair ? "Under repair" : "Operational") << endl;
+        
+        if (getConfirmation("Change repair status?")) {
+            Pipe before = pipe;
+            pipe.underRepair = !pipe.underRepair;
+            onRecordChanged(&before, &pipe);
+            cout << "Status changed successfully!\n";
+        }
+    }
+
+    void editStationWorkshops() {
+        if (stations.empty()) {
+            cout << "No stations available to edit!\n";
+            return;
+        }
+
+        displayAll(stations);
+        int stationId = getValidatedNumber<int>("\nEnter station ID to edit: ");
+        
+        auto it = stations.find(stationId);
+        if (it == stations.end()) {
+            cout << "Station with ID " << stationId << " not found!\n";
+            return;
+        }
+
+        CompressorStation& station = it->second;
+        CompressorStation before = station;
+        cout << "Current workshops: " << station.activeWorkshops << "/" << station.totalWorkshops << " active\n";
+        cout << "1. Start workshop\n2. Stop workshop\nChoose action: ";
+
+        int action = getValidatedNumber("", 1, 2);
+        unsigned int changeAmount = getValidatedNumber<unsigned int>("Enter number of workshops: ", 1);
+
+        if (action == 1) {
+            if (station.activeWorkshops + changeAmount <= station.totalWorkshops) {
+                station.activeWorkshops += changeAmount;
+                onRecordChanged(&before, &station);
+                cout << changeAmount << " workshop(s) started\n";
+            }
+            else {
+                cout << "Cannot start more than " << station.totalWorkshops - station.activeWorkshops << " workshops\n";
+            }
+        }
+        else {
+            if (changeAmount <= station.activeWorkshops) {
+                station.activeWorkshops -= changeAmount;
+                onRecordChanged(&before, &station);
+                cout << changeAmount << " workshop(s) stopped\n";
+            }
+            else {
+                cout << "Cannot stop more than " << station.activeWorkshops << " workshops\n";
+            }
+        }
+    }
+
+    template<typename T>
+    void deleteRecord(EntityStore<T>& store) {
+        if (store.empty()) {
+            cout << "No " << EntityTraits<T>::plural << " available to delete!\n";
+            return;
+        }
+
+        displayAll(store);
+        int id = getValidatedNumber<int>(string("\nEnter ") + EntityTraits<T>::singular + " ID to delete: ");
+
+        auto it = store.find(id);
+        if (it == store.end()) {
+            cout << EntityTraits<T>::typeName << " with ID " << id << " not found!\n";
+            return;
+        }
+
+        cout << "You are about to delete " << EntityTraits<T>::singular << ": " << it->second.name << " (ID: " << id << ")\n";
+        if (getConfirmation("Are you sure?")) {
+            removeRecords(store, { id });
+            cout << EntityTraits<T>::typeName << " deleted successfully!\n";
+        }
+    }
+
+    void saveData() {
+        string filename;
+        cout << "Enter filename to save (without extension): ";
+        getline(cin, filename);
+
+        if (filename == baseFilename && getConfirmation("Save only changes since the last save of " + filename + ".txt?")) {
+            if (!hasChanges()) {
+                cout << "No changes since the last save.\n";
+                return;
+            }
+
+            size_t changedRecords = pipes.dirtyIds.size() + stations.dirtyIds.size();
+            size_t deletedRecords = pipes.deletedIds.size() + stations.deletedIds.size();
+            if (writeDelta(filename)) {
+                if (!history.save(filename)) {
+                    cout << "Warning: Could not write event history to " << filename << ".events\n";
+                }
+                cout << "Changes successfully saved to " << deltaFilename(filename, deltaCount) << endl;
+                cout << "Saved: " << changedRecords << " changed, " << deletedRecords << " deleted record(s)\n";
             }
-            case 2: {
-                cout << "Search for pipes:\n";
-                cout << "1. Under repair\n";
-                cout << "2. Operational\n";
-                int statusChoice = getValidatedNumber("Choose status: ", 1, 2);
-                foundIds = findPipesByRepairStatus(statusChoice == 1);
-                break;
+            return;
+        }
+
+        ifstream testFile(filename + ".txt");
+        if (testFile.good()) {
+            testFile.close();
+            if (!getConfirmation("File already exists. Overwrite?")) {
+                cout << "Save cancelled.\n";
+                return;
             }
-            case 0:
+        }
+
+        if (writeFullSnapshot(filename)) {
+            if (!history.save(filename)) {
+                cout << "Warning: Could not write event history to " << filename << ".events\n";
+            }
+            cout << "Data successfully saved to " << filename << ".txt" << endl;
+            cout << "Saved: " << pipes.size() << " pipes, " << stations.size() << " stations\n";
+        }
+    }
+
+    void loadData() {
+        string filename;
+        cout << "Enter filename to load (without extension): ";
+        getline(cin, filename);
+
+        ifstream testFile(filename + ".txt");
+        if (!testFile) {
+            cout << "Error: Could not open file " << filename << ".txt" << endl;
+            return;
+        }
+        testFile.close();
+
+        if (!pipes.empty() || !stations.empty()) {
+            if (!getConfirmation("Current data will be overwritten. Continue?")) {
+                cout << "Load cancelled.\n";
                 return;
+            }
         }
-        
-        if (foundIds.empty()) {
-            cout << "No pipes found with the selected criteria.\n";
+
+        if (!readSnapshot(filename)) {
+            cout << "Error: Could not load " << filename << ".txt, no data was loaded\n";
             return;
         }
-        
-        displayPipesByIds(foundIds);
-        
-        cout << "\nBatch editing options:\n";
-        cout << "1. Edit all found pipes\n";
-        cout << "2. Select specific pipes to edit\n";
-        cout << "0. Cancel\n";
-        
-        int editChoice = getValidatedNumber("Choose editing mode: ", 0, 2);
-        
-        if (editChoice == 0) {
+        history.load(filename);
+
+        cout << "Data successfully loaded from " << filename << ".txt";
+        if (deltaCount > 0) {
+            cout << " and " << deltaCount << " delta file(s)";
+        }
+        cout << endl;
+        cout << "Loaded: " << pipes.size() << " pipes, " << stations.size() << " stations\n";
+        cout << "Next available IDs - Pipe: " << pipes.nextId << ", Station: " << stations.nextId << endl;
+        cout << "Event history: " << history.all().size() << " event(s)\n";
+    }
+
+    void compactData() {
+        string filename;
+        cout << "Enter filename to compact (without extension): ";
+        getline(cin, filename);
+
+        DataManager compacted;
+        if (!compacted.readSnapshot(filename)) {
+            cout << "Error: Could not open file " << filename << ".txt" << endl;
             return;
         }
-        
-        vector<int> pipesToEdit;
-        
-        if (editChoice == 1) {
-            pipesToEdit = foundIds;
-            cout << "Selected all " << foundIds.size() << " pipes for editing.\n";
-        } else if (editChoice == 2) {
-            cout << "Enter pipe IDs to edit (separated by spaces): ";
-            string input;
-            getline(cin, input);
-            
-            stringstream ss(input);
-            int id;
-            set<int> selectedIds;
-            
-            while (ss >> id) {
-                if (find(foundIds.begin(), foundIds.end(), id) != foundIds.end()) {
-                    selectedIds.insert(id);
-                } else {
-                    cout << "Pipe ID " << id << " not found in search results. Skipping.\n";
-                }
+
+        int mergedDeltas = compacted.deltaCount;
+        if (compacted.writeFullSnapshot(filename)) {
+            cout << "Merged " << mergedDeltas << " delta file(s) into " << filename << ".txt\n";
+            if (filename == baseFilename) {
+                deltaCount = 0;
             }
-            
-            if (selectedIds.empty()) {
-                cout << "No valid pipe IDs selected.\n";
+        }
+    }
+
+    void saveCompressedSnapshot() {
+        string filename;
+        cout << "Enter filename to save (without extension): ";
+        getline(cin, filename);
+        filename += ".snap";
+
+        ifstream testFile(filename);
+        if (testFile.good()) {
+            testFile.close();
+            if (!getConfirmation("File already exists. Overwrite?")) {
+                cout << "Save cancelled.\n";
                 return;
             }
-            
-            pipesToEdit.assign(selectedIds.begin(), selectedIds.end());
-            cout << "Selected " << pipesToEdit.size() << " pipes for editing.\n";
         }
-        
-        cout << "\nChoose editing action:\n";
-        cout << "1. Mark as under repair\n";
-        cout << "2. Mark as operational\n";
-        cout << "3. Toggle repair status (swap current status)\n";
-        
-        int action = getValidatedNumber("Choose action: ", 1, 3);
-        
-        int changedCount = 0;
-        for (int id : pipesToEdit) {
-            auto it = pipes.find(id);
-            if (it != pipes.end()) {
-                Pipe& pipe = it->second;
-                bool oldStatus = pipe.underRepair;
-                
-                switch (action) {
-                    case 1:
-                        pipe.underRepair = true;
-                        break;
-                    case 2:
-                        pipe.underRepair = false;
-                        break;
-                    case 3:
-                        pipe.underRepair = !pipe.underRepair;
-                        break;
-                }
-                
-                if (oldStatus != pipe.underRepair) {
-                    changedCount++;
+
+        vector<uint8_t> bytes = encodeColumnarSnapshot();
+        FileOutput outFile(filename);
+        outFile.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+        outFile.close();
+        if (!outFile) {
+            cout << "Error: Could not write file " << filename << endl;
+            return;
+        }
+
+        cout << "Snapshot successfully saved to " << filename << " (" << bytes.size() << " bytes)\n";
+        cout << "Saved: " << pipes.size() << " pipes, " << stations.size() << " stations\n";
+    }
+
+    void loadCompressedSnapshot() {
+        string filename;
+        cout << "Enter filename to load (without extension): ";
+        getline(cin, filename);
+        filename += ".snap";
+
+        FileInput inFile(filename);
+        if (!inFile) {
+            cout << "Error: Could not open file " << filename << endl;
+            return;
+        }
+
+        if (!pipes.empty() || !stations.empty()) {
+            if (!getConfirmation("Current data will be overwritten. Continue?")) {
+                cout << "Load cancelled.\n";
+                return;
+            }
+        }
+
+        vector<uint8_t> bytes((istreambuf_iterator<char>(inFile)), istreambuf_iterator<char>());
+        if (inFile.readFailed()) {
+            cout << "Error: Could not read file " << filename << endl;
+            return;
+        }
+        if (!decodeColumnarSnapshot(bytes)) {
+            cout << "Error: " << filename << " is not a valid snapshot\n";
+            return;
+        }
+        baseFilename = "";
+        deltaCount = 0;
+
+        cout << "Snapshot successfully loaded from " << filename << endl;
+        cout << "Loaded: " << pipes.size() << " pipes, " << stations.size() << " stations\n";
+    }
+
+    static string arrowFilename(const string& filename, const char* plural) {
+        return filename + "." + plural + ".arrow";
+    }
+
+    template<typename T>
+    static bool writeArrowFile(const EntityStore<T>& store, const string& path) {
+        FileOutput outFile(path);
+        if (!outFile) {
+            return false;
+        }
+        store.writeArrow(outFile);
+        outFile.close();
+        return !outFile.fail();
+    }
+
+    void exportArrow() {
+        string filename;
+        cout << "Enter filename to export (without extension): ";
+        getline(cin, filename);
+        string pipePath = arrowFilename(filename, EntityTraits<Pipe>::plural);
+        string stationPath = arrowFilename(filename, EntityTraits<CompressorStation>::plural);
+
+        ifstream testFile(pipePath);
+        if (testFile.good()) {
+            testFile.close();
+            if (!getConfirmation("File already exists. Overwrite?")) {
+                cout << "Export cancelled.\n";
+                return;
+            }
+        }
+
+        if (!writeArrowFile(pipes, pipePath)) {
+            cout << "Error: Could not write file " << pipePath << endl;
+            return;
+        }
+        if (!writeArrowFile(stations, stationPath)) {
+            cout << "Error: Could not write file " << stationPath << endl;
+            return;
+        }
+
+        cout << "Exported " << pipes.size() << " pipes to " << pipePath << "\n";
+        cout << "Exported " << stations.size() << " stations to " << stationPath << "\n";
+    }
+
+    // Prints the reason and returns false if the file cannot be imported as a whole.
+    template<typename T>
+    static bool readArrowFile(const string& path, vector<T>& records, vector<int>& usedIds) {
+        vector<uint8_t> bytes;
+        if (!readWholeFile(path, bytes) || !EntityStore<T>::readArrow(bytes, records)) {
+            cout << "Error: " << path << " is missing, not a supported Arrow file, or has values out of range\n";
+            return false;
+        }
+
+        unordered_set<int> seen;
+        for (const T& record : records) {
+            if (!seen.insert(record.id).second) {
+                cout << "Error: " << path << " has more than one " << EntityTraits<T>::singular << " with ID " << record.id << "\n";
+                return false;
+            }
+            if (!EntityTraits<T>::isValid(record)) {
+                cout << "Error: " << path << " has an invalid " << EntityTraits<T>::singular << " (ID " << record.id << ")\n";
+                return false;
+            }
+            usedIds.push_back(record.id);
+        }
+        return true;
+    }
+
+    void importArrow() {
+        string filename;
+        cout << "Enter filename to import (without extension): ";
+        getline(cin, filename);
+        string pipePath = arrowFilename(filename, EntityTraits<Pipe>::plural);
+        string stationPath = arrowFilename(filename, EntityTraits<CompressorStation>::plural);
+
+        vector<Pipe> pipeRecords;
+        vector<CompressorStation> stationRecords;
+        vector<int> usedPipes, usedStations;
+        if (!readArrowFile(pipePath, pipeRecords, usedPipes)
+            || !readArrowFile(stationPath, stationRecords, usedStations)) {
+            return;
+        }
+
+        if (!pipes.empty() || !stations.empty()) {
+            if (!getConfirmation("Current data will be overwritten. Continue?")) {
+                cout << "Import cancelled.\n";
+                return;
+            }
+        }
+
+        restoreStore(pipes, 1, {}, usedPipes, pipeRecords);
+        restoreStore(stations, 1, {}, usedStations, stationRecords);
+        onDataReloaded();
+        baseFilename = "";
+        deltaCount = 0;
+
+        cout << "Imported " << pipes.size() << " pipes from " << pipePath << "\n";
+        cout << "Imported " << stations.size() << " stations from " << stationPath << "\n";
+    }
+
+    void arrowMenu() {
+        cout << "\n=== ARROW EXPORT ===\n";
+        cout << "1. Export pipes and stations\n";
+        cout << "2. Import pipes and stations\n";
+        cout << "0. Back to main menu\n";
+
+        int choice = getValidatedNumber("Choose action: ", 0, 2);
+
+        switch (choice) {
+            case 1:
+                exportArrow();
+                break;
+            case 2:
+                if (ensureWritable()) {
+                    importArrow();
                 }
+                break;
+            case 0:
+                return;
+        }
+    }
+
+    void displayPipeStatistics(PipeGroupField field, const string& keyLabel) {
+        const unordered_map<long long, PipeTotals>& groups = aggregates.pipesBy(field, pipes);
+        vector<pair<long long, PipeTotals>> rows(groups.begin(), groups.end());
+        sort(rows.begin(), rows.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+        OutputBuffer out(cout);
+        out << "\n=== PIPE STATISTICS ===\n";
+        for (const auto& row : rows) {
+            const PipeTotals& totals = row.second;
+            if (field != PipeGroupField::Network) {
+                out << keyLabel << ": " << row.first << " | ";
             }
+            out << "Pipes: " << totals.count
+                << " | Total length: " << totals.totalLength << " km"
+                << " | Under repair: " << totals.underRepairCount
+                << " (" << totals.underRepairLength << " km)\n";
+        }
+    }
+
+    void displayStationStatistics(StationGroupField field, const string& keyLabel) {
+        const unordered_map<long long, StationTotals>& groups = aggregates.stationsBy(field, stations);
+        vector<pair<long long, StationTotals>> rows(groups.begin(), groups.end());
+        sort(rows.begin(), rows.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+        OutputBuffer out(cout);
+        out << "\n=== STATION STATISTICS ===\n";
+        for (const auto& row : rows) {
+            const StationTotals& totals = row.second;
+            if (field != StationGroupField::Network) {
+                out << keyLabel << ": " << row.first << " | ";
+            }
+            double averageUtilization = totals.utilizedStations > 0 ? totals.utilizationSum / totals.utilizedStations * 100.0 : 0.0;
+            out << "Stations: " << totals.count
+                << " | Workshops: " << totals.activeWorkshops << "/" << totals.totalWorkshops
+                << " | Average utilization: " << averageUtilization << "%\n";
+        }
+    }
+
+    void statisticsMenu() {
+        cout << "\n=== NETWORK STATISTICS ===\n";
+        cout << "1. Pipes - whole network\n";
+        cout << "2. Pipes by diameter\n";
+        cout << "3. Pipes by repair status\n";
+        cout << "4. Pipes by length\n";
+        cout << "5. Stations - whole network\n";
+        cout << "6. Stations by class\n";
+        cout << "7. Stations by total workshops\n";
+        cout << "0. Back to main menu\n";
+
+        int choice = getValidatedNumber("Choose statistics: ", 0, 7);
+
+        switch (choice) {
+            case 1:
+                displayPipeStatistics(PipeGroupField::Network, "");
+                break;
+            case 2:
+                displayPipeStatistics(PipeGroupField::Diameter, "Diameter (mm)");
+                break;
+            case 3:
+                displayPipeStatistics(PipeGroupField::RepairStatus, "Under repair (1 - yes)");
+                break;
+            case 4:
+                displayPipeStatistics(PipeGroupField::Length, "Length (km)");
+                break;
+            case 5:
+                displayStationStatistics(StationGroupField::Network, "");
+                break;
+            case 6:
+                displayStationStatistics(StationGroupField::StationClass, "Class");
+                break;
+            case 7:
+                displayStationStatistics(StationGroupField::TotalWorkshops, "Total workshops");
+                break;
+            case 0:
+                return;
+        }
+    }
+
+    void regionsMenu() {
+        map<int, size_t> pipeRegions = pipes.regionSizes();
+        map<int, size_t> stationRegions = stations.regionSizes();
+        set<int> regions = { activeRegion };
+        for (const auto& pair : pipeRegions) {
+            regions.insert(pair.first);
+        }
+        for (const auto& pair : stationRegions) {
+            regions.insert(pair.first);
+        }
+
+        cout << "\n=== REGIONS ===\n";
+        for (int region : regions) {
+            cout << "Region " << region << (region == activeRegion ? " (active)" : "")
+                << " | IDs: " << PipeMap::firstIdOf(region) << " - " << PipeMap::lastIdOf(region)
+                << " | Pipes: " << pipeRegions[region] << " | Stations: " << stationRegions[region] << "\n";
+        }
+        cout << "1. Set region for new pipes and stations\n";
+        cout << "0. Back to main menu\n";
+
+        int choice = getValidatedNumber("Choose action: ", 0, 1);
+        if (choice == 1) {
+            activeRegion = getValidatedNumber("Enter region (0 - " + to_string(REGION_COUNT - 1) + "): ", 0, REGION_COUNT - 1);
+            cout << "New pipes and stations will take IDs from region " << activeRegion << ".\n";
+        }
+    }
+
+    void displayUtilizationHistory() {
+        // Class 0 is a real class, so "all classes" is a separate choice.
+        int group = EventHistory::ALL_GROUPS;
+        if (getValidatedNumber("Stations (1 - all classes, 2 - one class): ", 1, 2) == 2) {
+            group = getValidatedNumber<int>("Station class: ", EventHistory::ALL_GROUPS + 1, numeric_limits<int>::max());
         }
-        
-        cout << "Successfully updated repair status for " << changedCount << " pipes.\n";
-        
-        if (getConfirmation("Show updated pipes?")) {
-            displayPipesByIds(pipesToEdit);
+        int64_t period = getValidatedNumber<int64_t>("Period in hours back from now: ", 1);
+
+        int64_t to = EventHistory::now() + 1;
+        int64_t from = to - period * 3600;
+        Rollup rollup = history.query(EventKind::Workshops, group, from, to);
+        double average;
+        if (!history.averageUtilization(group, from, to, average)) {
+            cout << "No station utilization recorded for this period.\n";
+            return;
+        }
+
+        cout << "Workshop changes: " << rollup.count
+            << " | Average utilization (time-weighted): " << average << "%";
+        if (rollup.count > 0) {
+            cout << " | Min: " << rollup.minValue << "%"
+                << " | Max: " << rollup.maxValue << "%";
         }
+        cout << "\n";
     }
 
-    void batchDeletePipes() {
-        if (pipes.empty()) {
-            cout << "No pipes available to delete!\n";
+    void displayRepairHistory() {
+        int64_t period = getValidatedNumber<int64_t>("Period in hours back from now: ", 1);
+
+        int64_t to = EventHistory::now() + 1;
+        int64_t from = to - period * 3600;
+        Rollup rollup = history.query(EventKind::RepairStatus, 0, from, to);
+
+        long long sentToRepair = (long long)rollup.sum;
+        cout << "Repair status changes: " << rollup.count
+            << " | Sent to repair: " << sentToRepair
+            << " | Returned to service: " << rollup.count - sentToRepair << "\n";
+    }
+
+    void displayRecentEvents() {
+        const vector<HistoryEvent>& events = history.all();
+        if (events.empty()) {
+            cout << "No events recorded.\n";
             return;
         }
-cout << "\n=== BATCH PIPE DELETION ===\n";
-        cout << "1. Search by name\n";
-        cout << "2. Search by repair status\n";
+
+        size_t count = getValidatedNumber<size_t>("Number of events to show: ", 1);
+        size_t first = events.size() - min(count, events.size());
+
+        OutputBuffer out(cout);
+        out << "\n=== RECENT EVENTS ===\n";
+        for (size_t i = first; i < events.size(); i++) {
+            const HistoryEvent& event = events[i];
+            out << "Time: " << event.timestamp;
+            if (event.kind == EventKind::Workshops) {
+                out << " | Station ID: " << event.objectId
+                    << " | Workshops: " << event.value << "/" << event.totalWorkshops
+                    << " | Class: " << event.stationClass << "\n";
+            } else {
+                out << " | Pipe ID: " << event.objectId
+                    << " | Under repair: " << (event.value != 0 ? "Yes" : "No") << "\n";
+            }
+        }
+    }
+
+    void historyMenu() {
+        cout << "\n=== EVENT HISTORY ===\n";
+        cout << "1. Average station utilization\n";
+        cout << "2. Pipe repair activity\n";
+        cout << "3. Recent events\n";
         cout << "0. Back to main menu\n";
-        
-        int choice = getValidatedNumber("Choose search type: ", 0, 2);
-        
-        vector<int> foundIds;
-        
+
+        int choice = getValidatedNumber("Choose report: ", 0, 3);
+
         switch (choice) {
-            case 1: {
-                string searchName;
-                cout << "Enter pipe name to search for: ";
-                getline(cin, searchName);
-                foundIds = findPipesByName(searchName);
+            case 1:
+                displayUtilizationHistory();
                 break;
-            }
-            case 2: {
-                cout << "Search for pipes:\n";
-                cout << "1. Under repair\n";
-                cout << "2. Operational\n";
-                int statusChoice = getValidatedNumber("Choose status: ", 1, 2);
-                foundIds = findPipesByRepairStatus(statusChoice == 1);
+            case 2:
+                displayRepairHistory();
+                break;
+            case 3:
+                displayRecentEvents();
                 break;
-            }
             case 0:
                 return;
         }
-        
-        if (foundIds.empty()) {
-            cout << "No pipes found with the selected criteria.\n";
+    }
+
+    void startChangeFeed() {
+        string path;
+        cout << "Enter change feed filename: ";
+        getline(cin, path);
+
+        auto subscriber = make_unique<FileChangeSubscriber>(path);
+        if (!subscriber->isOpen()) {
+            cout << "Error: Could not open file " << path << endl;
             return;
         }
-        
-        displayPipesByIds(foundIds);
-        
-        if (getConfirmation("Delete all these pipes?")) {
-            for (int id : foundIds) {
-                pipes.erase(id);
-                releaseId(usedPipeIds, id);
-            }
-            cout << "Successfully deleted " << foundIds.size() << " pipes.\n";
-        }
+
+        uint64_t firstSequence = FileChangeSubscriber::lastSequence(path) + 1;
+        feed.start(move(subscriber), firstSequence);
+        feedPath = path;
+        feedToSocket = false;
+        cout << "Change feed started, next sequence number: " << firstSequence << "\n";
     }
 
-    void batchDeleteStations() {
-        if (stations.empty()) {
-            cout << "No stations available to delete!\n";
+    void startSocketChangeFeed() {
+        if (!LocalSocket::supported()) {
+            cout << "A socket feed needs Unix domain sockets, which are not available on this system.\n";
             return;
         }
 
-        cout << "\n=== BATCH STATION DELETION ===\n";
-        vector<int> foundIds = findStationsByName();
-        
-        if (foundIds.empty()) {
-            cout << "No stations found with the specified name.\n";
+        string path;
+        cout << "Enter change feed socket path: ";
+        getline(cin, path);
+
+        uint64_t firstSequence = feed.lastPublished() + 1;
+        auto subscriber = make_unique<SocketChangeSubscriber>(path, firstSequence);
+        if (!subscriber->isListening()) {
+            cout << "Error: Could not listen on " << path << endl;
             return;
         }
-        
-        cout << "\n=== FOUND STATIONS ===\n";
-        for (int id : foundIds) {
-            auto it = stations.find(id);
-            if (it != stations.end()) {
-                cout << it->second;
-            }
+
+        feed.start(move(subscriber), firstSequence);
+        feedPath = path;
+        feedToSocket = true;
+        cout << "Change feed listening on " << path << ", next sequence number: " << firstSequence << "\n";
+        cout << "Consumers connect with --subscribe " << path << " [<sequence>]\n";
+    }
+
+    void readChangeFeed() {
+        string path = feedToSocket ? "" : feedPath;
+        if (path.empty()) {
+            cout << "Enter change feed filename: ";
+            getline(cin, path);
         }
-        
-        if (getConfirmation("Delete all these stations?")) {
-            for (int id : foundIds) {
-                stations.erase(id);
-                releaseId(usedStationIds, id);
+
+        FileInput inFile(path);
+        if (!inFile) {
+            cout << "Error: Could not open file " << path << endl;
+            return;
+        }
+
+        uint64_t fromSequence = getValidatedNumber<uint64_t>("Show events starting from sequence number: ", 1);
+
+        OutputBuffer out(cout);
+        string line;
+        size_t shown = 0;
+        while (getline(inFile, line)) {
+            if (strtoull(line.c_str(), nullptr, 10) >= fromSequence) {
+                out << line << "\n";
+                shown++;
             }
-            cout << "Successfully deleted " << foundIds.size() << " stations.\n";
         }
+        if (inFile.readFailed()) {
+            out << "Error: Could not read all of " << path << "\n";
+        }
+        out << "Events shown: " << shown << "\n";
     }
 
-    void searchPipesMenu() {
-        if (pipes.empty()) {
-            cout << "No pipes available to search!\n";
-            return;
+    void changeFeedMenu() {
+        cout << "\n=== CHANGE FEED ===\n";
+        if (feed.active()) {
+            cout << "Publishing to " << feedPath << ", last sequence number: " << feed.lastPublished() << "\n";
+            if (feed.droppedEvents() > 0) {
+                cout << "Subscriber fell behind: " << feed.droppedEvents() << " event(s) dropped, listed in the RESET that follows them\n";
+            }
+        } else {
+            cout << "Change feed is stopped\n";
         }
-
-        cout << "\n=== PIPE SEARCH ===\n";
-        cout << "1. Search by name\n";
-        cout << "2. Search by repair status\n";
+        cout << "1. Start feed to file\n";
+        cout << "2. Stop feed\n";
+        cout << "3. Read events from sequence number\n";
+        cout << "4. Start feed to socket\n";
         cout << "0. Back to main menu\n";
-        
-        int choice = getValidatedNumber("Choose search type: ", 0, 2);
-        
+
+        int choice = getValidatedNumber("Choose action: ", 0, 4);
+
         switch (choice) {
             case 1:
-                searchPipesByName();
+                startChangeFeed();
                 break;
             case 2:
-                searchPipesByRepairStatus();
+                feed.stop();
+                cout << "Change feed stopped.\n";
+                break;
+            case 3:
+                readChangeFeed();
+                break;
+            case 4:
+                startSocketChangeFeed();
                 break;
             case 0:
                 return;
         }
     }
 
-    vector<int> findStationsByName() {
-        vector<int> foundIds;
-        if (stations.empty()) {
-            return foundIds;
+    void setGeometryFromStations(Pipe& pipe) {
+        const CompressorStation& start = stations.at(pipe.startStationId);
+        const CompressorStation& end = stations.at(pipe.endStationId);
+        pipe.startX = start.x;
+        pipe.startY = start.y;
+        pipe.endX = end.x;
+        pipe.endY = end.y;
+        pipe.geometryKnown = true;
+    }
+
+    void connectPipe() {
+        if (pipes.empty() || stations.empty()) {
+            cout << "Pipes and stations are required to connect!\n";
+            return;
         }
 
-        string searchName;
-        cout << "Enter station name to search for: ";
-        getline(cin, searchName);
-        
-        string searchNameLower = toLower(searchName);
-        
-        for (const auto& pair : stations) {
-            if (toLower(pair.second.name).find(searchNameLower) != string::npos) {
-                foundIds.push_back(pair.first);
-            }
+        int pipeId = getValidatedNumber<int>("Enter pipe ID to connect: ");
+        auto it = pipes.find(pipeId);
+        if (it == pipes.end()) {
+            cout << "Pipe with ID " << pipeId << " not found!\n";
+            return;
         }
-        
-        return foundIds;
+
+        int startId = getValidatedNumber<int>("Enter start station ID (0 - disconnect): ", 0);
+        int endId = startId == 0 ? 0 : getValidatedNumber<int>("Enter end station ID: ", 1);
+        if (startId != 0 && (stations.find(startId) == stations.end() || stations.find(endId) == stations.end())) {
+            cout << "Station not found!\n";
+            return;
+        }
+        if (startId != 0 && startId == endId) {
+            cout << "A pipe cannot start and end at the same station!\n";
+            return;
+        }
+
+        Pipe& pipe = it->second;
+        Pipe before = pipe;
+        pipe.startStationId = startId;
+        pipe.endStationId = endId;
+        if (startId != 0 && stations.at(startId).hasLocation() && stations.at(endId).hasLocation()) {
+            setGeometryFromStations(pipe);
+        }
+        onRecordChanged(&before, &pipe);
+        cout << (startId == 0 ? "Pipe disconnected.\n" : "Pipe connected successfully!\n");
     }
 
-    void searchStationsByName() {
-        if (stations.empty()) {
-            cout << "No stations available to search!\n";
+    void runSimulation() {
+        if (pipes.empty() || stations.empty()) {
+            cout << "Pipes and stations are required to simulate!\n";
             return;
         }
-vector<int> foundIds = findStationsByName();
-        
-        if (foundIds.empty()) {
-            cout << "No stations found with the specified name.\n";
+
+        int hours = getValidatedNumber("Simulation length in hours: ", 1, 24 * 365);
+        int stepSeconds = getValidatedNumber("Time step in seconds (a divisor of 3600): ", 1, 3600);
+        while (3600 % stepSeconds != 0) {
+            cout << "Invalid input! The step must divide an hour evenly (e.g. 1, 10, 60, 300, 3600).\n";
+            stepSeconds = getValidatedNumber("Time step in seconds (a divisor of 3600): ", 1, 3600);
+        }
+
+        SimulationScenario scenario;
+        while (true) {
+            cout << "\nWhat-if changes (live data is not modified):\n";
+            cout << "1. Set pipe repair status\n";
+            cout << "2. Set station active workshops\n";
+            cout << "3. Run simulation\n";
+            cout << "0. Cancel\n";
+            int choice = getValidatedNumber("Choose action: ", 0, 3);
+
+            if (choice == 0) {
+                return;
+            }
+            if (choice == 3) {
+                break;
+            }
+            if (choice == 1) {
+                int pipeId = getValidatedNumber<int>("Enter pipe ID: ");
+                if (pipes.find(pipeId) == pipes.end()) {
+                    cout << "Pipe with ID " << pipeId << " not found!\n";
+                    continue;
+                }
+                scenario.pipeUnderRepair[pipeId] = getConfirmation("Under repair in this scenario?");
+            } else {
+                int stationId = getValidatedNumber<int>("Enter station ID: ");
+                auto it = stations.find(stationId);
+                if (it == stations.end()) {
+                    cout << "Station with ID " << stationId << " not found!\n";
+                    continue;
+                }
+                scenario.stationActiveWorkshops[stationId] =
+                    getValidatedNumber<unsigned int>("Active workshops in this scenario: ", 0, it->second.totalWorkshops);
+            }
+        }
+
+        auto started = chrono::steady_clock::now();
+        FlowSimulator simulator;
+        simulator.build(pipes, stations, scenario);
+        WorkerPool pool;
+        SimulationResult result = simulator.run(pool, hours, stepSeconds);
+        double elapsed = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+
+        OutputBuffer out(cout);
+        out << "\n=== SIMULATION RESULTS ===\n";
+        out << "Operational connected pipes: " << result.activePipes << "\n";
+        for (int hour = 0; hour < hours && hours <= 48; hour++) {
+            out << "Hour " << hour + 1 << ": delivered " << result.deliveredPerHour[hour] << "\n";
+        }
+        out << "Total supplied: " << result.supplied << "\n";
+        out << "Total delivered: " << result.delivered << "\n";
+        out << "Linepack: " << result.initialLinepack << " -> " << result.finalLinepack << "\n";
+        out << "Consumers left without gas: " << result.starvedSinks << "\n";
+        out << "Computed in " << elapsed << " s on " << pool.threadCount() << " thread(s)\n";
+    }
+
+    void prioritizeRepairs() {
+        vector<int> underRepair = pipes.findEqual(&Pipe::underRepair, true);
+        if (underRepair.empty()) {
+            cout << "No pipes under repair.\n";
             return;
         }
-        
-        cout << "\n=== FOUND STATIONS ===\n";
-        for (int id : foundIds) {
-            auto it = stations.find(id);
-            if (it != stations.end()) {
-                cout << it->second;
+
+        size_t limit = getValidatedNumber<size_t>("How many pipes to rank (0 - all): ", 0);
+        if (limit == 0) {
+            limit = underRepair.size();
+        }
+
+        auto started = chrono::steady_clock::now();
+        WorkerPool pool;
+        RepairPrioritizer prioritizer;
+        vector<RepairPriority> ranking = prioritizer.rank(pipes, stations, limit, pool);
+        double elapsed = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+
+        OutputBuffer out(cout);
+        out << "\n=== REPAIR PRIORITIES ===\n";
+        for (size_t i = 0; i < ranking.size(); i++) {
+            const RepairPriority& priority = ranking[i];
+            const Pipe& pipe = pipes.at(priority.pipeId);
+            out << i + 1 << ". ID: " << pipe.id
+                << " | Name: " << pipe.name
+                << " | Length: " << pipe.length << " km"
+                << " | Diameter: " << pipe.diameter << " mm"
+                << " | Reconnected station pairs: " << priority.reconnectedPairs
+                << " | Capacity: " << priority.capacity << "\n";
+        }
+        out << "Ranked " << ranking.size() << " of " << underRepair.size() << " pipe(s) in " << elapsed << " s\n";
+    }
+
+    uint64_t chooseVersion() {
+        cout << "Current version: " << versions.current()
+            << ", oldest available: " << versions.oldest() << "\n";
+        cout << "1. By version number\n";
+        cout << "2. By minutes ago\n";
+        int choice = getValidatedNumber("Choose point in time: ", 1, 2);
+
+        if (choice == 1) {
+            return getValidatedNumber<uint64_t>("Enter version: ", versions.oldest(), versions.current());
+        }
+        int64_t minutes = getValidatedNumber<int64_t>("Enter minutes ago: ", 0);
+        int64_t now = EventHistory::now();
+        if (minutes > (now - versions.oldestTimestamp()) / 60) {
+            cout << "Notice: history only goes back " << (now - versions.oldestTimestamp()) / 60
+                << " minute(s); showing the oldest available version " << versions.oldest() << " instead.\n";
+        }
+        return versions.versionAt(now - minutes * 60);
+    }
+
+    template<typename T, typename Predicate>
+    void displayAsOf(const PointInTimeView<T>& view, uint64_t version, const string& nameFilter, Predicate matches) {
+        string filter = toLower(nameFilter);
+        size_t shown = 0;
+
+        OutputBuffer out(cout);
+        out << "\n=== " << EntityTraits<T>::title << " AS OF VERSION " << version << " ===\n";
+        view.forEach([&](const T& record) {
+            if ((filter.empty() || toLower(record.name).find(filter) != string::npos) && matches(record)) {
+                out << record;
+                shown++;
             }
+        });
+        out << "Shown: " << shown << " " << EntityTraits<T>::singular << "(s)\n";
+    }
+
+    void displayPipesAsOf(uint64_t version, const string& nameFilter, int repairFilter) {
+        displayAsOf(versions.pipesAsOf(pipes, version), version, nameFilter, [repairFilter](const Pipe& pipe) {
+            return repairFilter < 0 || pipe.underRepair == (repairFilter == 1);
+        });
+    }
+
+    void displayStationsAsOf(uint64_t version, const string& nameFilter) {
+        displayAsOf(versions.stationsAsOf(stations, version), version, nameFilter, [](const CompressorStation&) {
+            return true;
+        });
+    }
+
+    // Browsing sorts and pages an EntityStore, so the view is copied into one.
+    template<typename T>
+    void browseAsOf(const PointInTimeView<T>& view, uint64_t version) {
+        EntityStore<T> snapshot;
+        view.forEach([&snapshot](const T& record) {
+            snapshot[record.id] = record;
+        });
+        if (snapshot.empty()) {
+            cout << "No " << EntityTraits<T>::plural << " at version " << version << ".\n";
+            return;
         }
-        cout << "Total found: " << foundIds.size() << " station(s)\n";
+        browse(snapshot, snapshot.allIds(), string(EntityTraits<T>::title) + " AS OF VERSION " + to_string(version));
     }
 
-    void searchStationsByUnusedPercentage() {
-        if (stations.empty()) {
-            cout << "No stations available to search!\n";
+    void timeTravelMenu() {
+        cout << "\n=== POINT-IN-TIME QUERIES ===\n";
+        cout << "1. View all objects\n";
+        cout << "2. Search pipes by name\n";
+        cout << "3. Search pipes by repair status\n";
+        cout << "4. Search stations by name\n";
+        cout << "5. Set version retention\n";
+        cout << "6. Search stations by percentage of unused workshops\n";
+        cout << "7. Browse objects\n";
+        cout << "0. Back to main menu\n";
+
+        int choice = getValidatedNumber("Choose action: ", 0, 7);
+        if (choice == 0) {
+            return;
+        }
+        if (choice == 5) {
+            cout << "Versions kept: " << versions.retainedVersions() << "\n";
+            versions.setRetention(getValidatedNumber<size_t>("Enter number of versions to keep: ", 0));
+            cout << "Oldest available version: " << versions.oldest() << "\n";
             return;
         }
 
-        cout << "Search stations by percentage of unused workshops (0-100%)\n";
-        double minPercentage = getValidatedDouble("Enter minimum percentage: ", 0.0, 100.0);
-        double maxPercentage = getValidatedDouble("Enter maximum percentage: ", minPercentage, 100.0);
-        
-        vector<int> foundIds;
-        
-        for (const auto& pair : stations) {
-            const CompressorStation& station = pair.second;
-            if (station.totalWorkshops > 0) {
-                double unusedPercentage = (1.0 - (double)station.activeWorkshops / station.totalWorkshops) * 100.0;
-                if (unusedPercentage >= minPercentage && unusedPercentage <= maxPercentage) {
-                    foundIds.push_back(pair.first);
-                }
+        uint64_t version = chooseVersion();
+        string name;
+        switch (choice) {
+            case 1:
+                displayPipesAsOf(version, "", -1);
+                displayStationsAsOf(version, "");
+                break;
+            case 2:
+                cout << "Enter pipe name to search for: ";
+                getline(cin, name);
+                displayPipesAsOf(version, name, -1);
+                break;
+            case 3:
+                displayPipesAsOf(version, "", getValidatedNumber("Under repair (1 - yes, 0 - no): ", 0, 1));
+                break;
+            case 4:
+                cout << "Enter station name to search for: ";
+                getline(cin, name);
+                displayStationsAsOf(version, name);
+                break;
+            case 6: {
+                double minPercentage = getValidatedDouble("Enter minimum percentage: ", 0.0, 100.0);
+                double maxPercentage = getValidatedDouble("Enter maximum percentage: ", minPercentage, 100.0);
+                displayAsOf(versions.stationsAsOf(stations, version), version, "", [minPercentage, maxPercentage](const CompressorStation& station) {
+                    return hasUnusedPercentage(station, minPercentage, maxPercentage);
+                });
+                break;
             }
+            case 7:
+                if (getValidatedNumber("Object type (1 - pipes, 2 - compressor stations): ", 1, 2) == 1) {
+                    browseAsOf(versions.pipesAsOf(pipes, version), version);
+                } else {
+                    browseAsOf(versions.stationsAsOf(stations, version), version);
+                }
+                break;
         }
-        
-        if (foundIds.empty()) {
-            cout << "No stations found with unused workshops percentage between " 
-                 << minPercentage << "% and " << maxPercentage << "%\n";
+    }
+
+    double getCoordinate(const string& prompt) {
+        return getValidatedDouble(prompt, -SPATIAL_COORDINATE_LIMIT, SPATIAL_COORDINATE_LIMIT);
+    }
+
+    void displayStationsWithDistance(const vector<pair<double, int>>& found, double elapsed) {
+        OutputBuffer out(cout);
+        out << "\n=== FOUND STATIONS ===\n";
+        for (const auto& entry : found) {
+            out << "Distance: " << entry.first << " km | " << stations.at(entry.second);
+        }
+        out << "Total found: " << found.size() << " station(s) in " << elapsed * 1e6 << " us\n";
+    }
+
+    void setStationLocation() {
+        int stationId = getValidatedNumber<int>("Enter station ID: ");
+        auto it = stations.find(stationId);
+        if (it == stations.end()) {
+            cout << "Station with ID " << stationId << " not found!\n";
             return;
         }
-        
-        cout << "\n=== FOUND STATIONS ===\n";
-        for (int id : foundIds) {
-            auto it = stations.find(id);
-            if (it != stations.end()) {
-                const CompressorStation& station = it->second;
-                double unusedPercentage = (1.0 - (double)station.activeWorkshops / station.totalWorkshops) * 100.0;
-                
-                cout << "ID: " << station.id
-                    << " | Name: " << station.name
-                    << " | Workshops: " << station.activeWorkshops << "/" << station.totalWorkshops
-                    << " | Unused: " << unusedPercentage << "%"
-                    << " | Class: " << station.stationClass << "\n";
+
+        CompressorStation& station = it->second;
+        CompressorStation before = station;
+        station.locationKnown = getConfirmation("Is the location known?");
+        station.x = station.locationKnown ? getCoordinate("Enter location X (km): ") : 0.0;
+        station.y = station.locationKnown ? getCoordinate("Enter location Y (km): ") : 0.0;
+        onRecordChanged(&before, &station);
+
+        size_t moved = rerouteConnectedPipes(stationId);
+        cout << "Location updated.\n";
+        if (moved > 0) {
+            cout << "Endpoints updated for " << moved << " connected pipe(s).\n";
+        }
+    }
+
+    // Pipes routed to a station follow it when it moves.
+    size_t rerouteConnectedPipes(int stationId) {
+        vector<int> connected = pipes.findEqual(&Pipe::startStationId, stationId);
+        vector<int> ending = pipes.findEqual(&Pipe::endStationId, stationId);
+        connected.insert(connected.end(), ending.begin(), ending.end());
+
+        size_t moved = 0;
+        for (int pipeId : connected) {
+            Pipe& pipe = pipes.at(pipeId);
+            auto start = stations.find(pipe.startStationId);
+            auto end = stations.find(pipe.endStationId);
+            if (start == stations.end() || end == stations.end()
+                || !start->second.hasLocation() || !end->second.hasLocation()) {
+                continue;
             }
+            Pipe before = pipe;
+            setGeometryFromStations(pipe);
+            onRecordChanged(&before, &pipe);
+            moved++;
         }
-        cout << "Total found: " << foundIds.size() << " station(s)\n";
+        return moved;
     }
 
-    void searchStationsMenu() {
-        if (stations.empty()) {
-            cout << "No stations available to search!\n";
+    void setPipeGeometry() {
+        int pipeId = getValidatedNumber<int>("Enter pipe ID: ");
+        auto it = pipes.find(pipeId);
+        if (it == pipes.end()) {
+            cout << "Pipe with ID " << pipeId << " not found!\n";
             return;
         }
 
-        cout << "\n=== STATION SEARCH ===\n";
-        cout << "1. Search by name\n";
-        cout << "2. Search by percentage of unused workshops\n";
+        Pipe& pipe = it->second;
+        Pipe before = pipe;
+        if (pipe.startStationId != 0 && stations.find(pipe.startStationId) != stations.end()
+            && stations.find(pipe.endStationId) != stations.end()
+            && getConfirmation("Take endpoints from the connected stations?")) {
+            setGeometryFromStations(pipe);
+        } else if (getConfirmation("Are the endpoints known?")) {
+            pipe.startX = getCoordinate("Enter start X (km): ");
+            pipe.startY = getCoordinate("Enter start Y (km): ");
+            pipe.endX = getCoordinate("Enter end X (km): ");
+            pipe.endY = getCoordinate("Enter end Y (km): ");
+            pipe.geometryKnown = true;
+        } else {
+            pipe.startX = pipe.startY = pipe.endX = pipe.endY = 0.0;
+            pipe.geometryKnown = false;
+        }
+        onRecordChanged(&before, &pipe);
+        cout << "Endpoints updated.\n";
+    }
+
+    void spatialMenu() {
+        cout << "\n=== SPATIAL QUERIES ===\n";
+        cout << "Stations with location: " << spatial.indexedStations() << "\n";
+        cout << "1. Stations within radius\n";
+        cout << "2. Nearest stations\n";
+        cout << "3. Pipes in area\n";
+        cout << "4. Set station location\n";
+        cout << "5. Set pipe endpoints\n";
         cout << "0. Back to main menu\n";
-        
-        int choice = getValidatedNumber("Choose search type: ", 0, 2);
-        
+
+        int choice = getValidatedNumber("Choose action: ", 0, 5);
+
         switch (choice) {
-            case 1:
-                searchStationsByName();
+            case 1: {
+                double x = getCoordinate("Enter center X (km): ");
+                double y = getCoordinate("Enter center Y (km): ");
+                double radius = getValidatedDouble("Enter radius (km): ", 0.0, SPATIAL_COORDINATE_LIMIT);
+                auto started = chrono::steady_clock::now();
+                vector<pair<double, int>> found = spatial.stationsWithin(x, y, radius);
+                displayStationsWithDistance(found, chrono::duration<double>(chrono::steady_clock::now() - started).count());
                 break;
-            case 2:
-                searchStationsByUnusedPercentage();
+            }
+            case 2: {
+                double x = getCoordinate("Enter point X (km): ");
+                double y = getCoordinate("Enter point Y (km): ");
+                size_t count = getValidatedNumber<size_t>("How many stations: ");
+                auto started = chrono::steady_clock::now();
+                vector<pair<double, int>> found = spatial.nearestStations(x, y, count);
+                displayStationsWithDistance(found, chrono::duration<double>(chrono::steady_clock::now() - started).count());
+                break;
+            }
+            case 3: {
+                double minX = getCoordinate("Enter min X (km): ");
+                double minY = getCoordinate("Enter min Y (km): ");
+                double maxX = getValidatedDouble("Enter max X (km): ", minX, SPATIAL_COORDINATE_LIMIT);
+                double maxY = getValidatedDouble("Enter max Y (km): ", minY, SPATIAL_COORDINATE_LIMIT);
+                auto started = chrono::steady_clock::now();
+                vector<int> found = spatial.pipesInBox(minX, minY, maxX, maxY);
+                double elapsed = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+                if (found.empty()) {
+                    cout << "No pipes found in the area.\n";
+                } else {
+                    displayFound(pipes, found);
+                }
+                cout << "Query time: " << elapsed * 1e6 << " us\n";
+                break;
+            }
+            case 4:
+                if (ensureWritable()) {
+                    setStationLocation();
+                }
+                break;
+            case 5:
+                if (ensureWritable()) {
+                    setPipeGeometry();
+                }
                 break;
             case 0:
                 return;
         }
     }
 
-    void addPipe() {
-        Pipe newPipe;
-        newPipe.id = generateUniqueId(usedPipeIds, nextPipeId);
-        
-        cout << "Enter pipe data:\n";
-        cin >> newPipe;
-        
-        pipes[newPipe.id] = newPipe;
-        cout << "Pipe added successfully! (ID: " << newPipe.id << ")\n";
+    bool ensureWritable() const {
+        if (follower) {
+            cout << "This node is a read-only follower. Promote it to primary to make changes.\n";
+            return false;
+        }
+        return true;
     }
 
-    void addStation() {
-        CompressorStation newStation;
-        newStation.id = generateUniqueId(usedStationIds, nextStationId);
-        
-        cout << "Enter station data:\n";
-        cin >> newStation;
-        
-        stations[newStation.id] = newStation;
-        cout << "Station added successfully! (ID: " << newStation.id << ")\n";
+    static bool changesState(int choice) {
+        static const set<int> actions = { 1, 2, 4, 5, 6, 7, 10, 11, 12, 14, 18, 22 };
+        return actions.count(choice) > 0;
     }
 
-    void editPipeStatus() {
-        if (pipes.empty()) {
-            cout << "No pipes available to edit!\n";
-            return;
+    uint64_t writeReplicationSnapshot(ostream& out) const {
+        pipes.writeIdHeader(out);
+        stations.writeIdHeader(out);
+        for (int index : pipes.shardIndexes()) {
+            pipes.writeShard(out, index);
         }
-displayAllPipes();
-        int pipeId = getValidatedNumber<int>("\nEnter pipe ID to edit: ");
-        
-        auto it = pipes.find(pipeId);
-        if (it == pipes.end()) {
-            cout << "Pipe with ID " << pipeId << " not found!\n";
-            return;
+        for (int index : stations.shardIndexes()) {
+            stations.writeShard(out, index);
         }
+        return replicationFeed.lastPublished();
+    }
 
-        Pipe& pipe = it->second;
-        cout << "Current repair status: " << (pipe.underRepair ? "Under repair" : "Operational") << endl;
-        
-        if (getConfirmation("Change repair status?")) {
-            pipe.underRepair = !pipe.underRepair;
-            cout << "Status changed successfully!\n";
+    void applyReplicatedSnapshot(const string& text) {
+        istringstream in(text);
+        pipes.reset();
+        stations.reset();
+
+        string line;
+        while (getline(in, line)) {
+            if (!pipes.readSection(line, in)) {
+                stations.readSection(line, in);
+            }
         }
+
+        baseFilename = "";
+        deltaCount = 0;
+        onDataReloaded();
     }
 
-    void editStationWorkshops() {
-        if (stations.empty()) {
-            cout << "No stations available to edit!\n";
+    template<typename T>
+    void applyReplicatedRecord(EntityStore<T>& store, const string& operation, int id, const string& record) {
+        if (operation == "DELETE") {
+            removeRecords(store, { id });
             return;
         }
 
-        displayAllStations();
-        int stationId = getValidatedNumber<int>("\nEnter station ID to edit: ");
-        
-        auto it = stations.find(stationId);
-        if (it == stations.end()) {
-            cout << "Station with ID " << stationId << " not found!\n";
+        T after;
+        if (!EntityStore<T>::parse(record, after) || after.id != id) {
             return;
         }
+        auto it = store.find(id);
+        if (it == store.end()) {
+            store.noteUsedId(id);
+            store[id] = after;
+            onRecordChanged(nullptr, &after);
+        } else {
+            T before = move(it->second);
+            it->second = after;
+            onRecordChanged(&before, &after);
+        }
+    }
 
-        CompressorStation& station = it->second;
-        cout << "Current workshops: " << station.activeWorkshops << "/" << station.totalWorkshops << " active\n";
-        cout << "1. Start workshop\n2. Stop workshop\nChoose action: ";
-
-        int action = getValidatedNumber("", 1, 2);
-        unsigned int changeAmount = getValidatedNumber<unsigned int>("Enter number of workshops: ", 1);
+    // Each line is a change event: "<sequence> <time> <operation> <entity> <id> | <record>".
+    void applyReplicatedEvents(const vector<string>& lines) {
+        for (const string& line : lines) {
+            size_t separator = line.find(" | ");
+            istringstream header(line.substr(0, separator));
+            uint64_t sequence = 0;
+            int64_t timestamp = 0;
+            string operation, entity;
+            int id = 0;
+            header >> sequence >> timestamp >> operation >> entity >> id;
 
-        if (action == 1) {
-            if (station.activeWorkshops + changeAmount <= station.totalWorkshops) {
-                station.activeWorkshops += changeAmount;
-                cout << changeAmount << " workshop(s) started\n";
-            }
-            else {
-                cout << "Cannot start more than " << station.totalWorkshops - station.activeWorkshops << " workshops\n";
-            }
-        }
-        else {
-            if (changeAmount <= station.activeWorkshops) {
-                station.activeWorkshops -= changeAmount;
-                cout << changeAmount << " workshop(s) stopped\n";
-            }
-            else {
-                cout << "Cannot stop more than " << station.activeWorkshops << " workshops\n";
+            string record = separator == string::npos ? "" : line.substr(separator + 3);
+            if (entity == "PIPE") {
+                applyReplicatedRecord(pipes, operation, id, record);
+            } else if (entity == "STATION") {
+                applyReplicatedRecord(stations, operation, id, record);
             }
         }
     }
 
-    void deletePipe() {
-        if (pipes.empty()) {
-            cout << "No pipes available to delete!\n";
+    void startReplication() {
+        string path;
+        cout << "Enter socket path: ";
+        getline(cin, path);
+
+        auto server = make_unique<ReplicationServer>(path, stateMutex,
+            [this](ostream& out) { return writeReplicationSnapshot(out); });
+        if (!server->isListening()) {
+            cout << "Error: Could not listen on " << path << " (path too long, not a socket, or already in use)\n";
             return;
         }
 
-        displayAllPipes();
-        int pipeId = getValidatedNumber<int>("\nEnter pipe ID to delete: ");
-        
-        auto it = pipes.find(pipeId);
-        if (it == pipes.end()) {
-            cout << "Pipe with ID " << pipeId << " not found!\n";
-            return;
+        replicationServer = server.get();
+        replicationFeed.start(move(server), max(replicationStart, replicationFeed.lastPublished() + 1));
+        cout << "Serving followers on " << path << "\n";
+    }
+
+    void stopReplication() {
+        replicationFeed.stop();
+        replicationServer = nullptr;
+        cout << "Replication stopped.\n";
+    }
+
+    void displayFollowers() {
+        uint64_t last = replicationServer->lastSequence();
+        vector<ReplicationServer::FollowerStatus> status = replicationServer->followerStatus();
+        cout << "Last sequence number: " << last << "\n";
+        cout << "Connected followers: " << status.size()
+            << ", disconnected: " << replicationServer->disconnectedFollowers() << "\n";
+        for (const ReplicationServer::FollowerStatus& entry : status) {
+            cout << "Follower " << entry.number << ": ";
+            if (entry.synchronized) {
+                cout << "acknowledged " << entry.acknowledged << ", behind by "
+                    << last - min(last, entry.acknowledged) << " change(s)";
+            } else {
+                cout << "waiting for snapshot";
+            }
+            cout << ", unsent " << entry.backlog << " bytes\n";
         }
+    }
 
-        cout << "You are about to delete pipe: " << it->second.name << " (ID: " << pipeId << ")\n";
-        if (getConfirmation("Are you sure?")) {
-            pipes.erase(it);
-            releaseId(usedPipeIds, pipeId);
-            cout << "Pipe deleted successfully!\n";
+    void displayFollowerStatus() const {
+        int64_t now = EventHistory::now();
+        uint64_t applied = follower->applied();
+        uint64_t primary = follower->primary();
+
+        cout << "Primary: " << follower->socketPath() << (follower->isConnected() ? " (connected)" : " (disconnected)") << "\n";
+        cout << "Applied sequence number: " << applied << "\n";
+        cout << "Primary sequence number: " << primary << "\n";
+        cout << "Behind by: " << primary - applied << " change(s)";
+        if (primary > applied && follower->appliedAt() > 0) {
+            cout << ", " << max<int64_t>(0, now - follower->appliedAt()) << " second(s)";
+        }
+        cout << "\n";
+        if (follower->lastMessageAt() > 0) {
+            cout << "Last message from primary: " << max<int64_t>(0, now - follower->lastMessageAt()) << " second(s) ago\n";
         }
+        cout << "Snapshots applied: " << follower->snapshots() << ", changes applied: " << follower->changes() << "\n";
     }
 
-    void deleteStation() {
-        if (stations.empty()) {
-            cout << "No stations available to delete!\n";
+    void promoteToPrimary() {
+        if (!getConfirmation("Stop following the primary and accept changes on this node?")) {
             return;
         }
+        follower->stop();
+        replicationStart = follower->applied() + 1;
+        follower.reset();
+        cout << "Promoted to primary at sequence number " << replicationStart - 1 << ". Changes are now accepted.\n";
+    }
 
-        displayAllStations();
-        int stationId = getValidatedNumber<int>("\nEnter station ID to delete: ");
-        
-        auto it = stations.find(stationId);
-        if (it == stations.end()) {
-            cout << "Station with ID " << stationId << " not found!\n";
+    void replicationMenu() {
+        cout << "\n=== REPLICATION ===\n";
+        if (!LocalSocket::supported()) {
+            cout << "Replication needs Unix domain sockets, which are not available on this system.\n";
             return;
         }
 
-        cout << "You are about to delete station: " << it->second.name << " (ID: " << stationId << ")\n";
-        if (getConfirmation("Are you sure?")) {
-            stations.erase(it);
-            releaseId(usedStationIds, stationId);
-            cout << "Station deleted successfully!\n";
-        }
-    }
+        if (follower) {
+            displayFollowerStatus();
+            cout << "1. Refresh status\n";
+            cout << "2. Promote to primary\n";
+            cout << "0. Back to main menu\n";
 
-    void saveData() {
-        string filename;
-        cout << "Enter filename to save (without extension): ";
-        getline(cin, filename);
-        filename += ".txt";
-ifstream testFile(filename);
-        if (testFile.good()) {
-            testFile.close();
-            if (!getConfirmation("File already exists. Overwrite?")) {
-                cout << "Save cancelled.\n";
-                return;
+            int choice = getValidatedNumber("Choose action: ", 0, 2);
+            if (choice == 1) {
+                displayFollowerStatus();
+            } else if (choice == 2) {
+                promoteToPrimary();
             }
-        }
-
-        ofstream outFile(filename);
-        if (!outFile) {
-            cout << "Error: Could not create file " << filename << endl;
             return;
         }
 
-        outFile << "[NEXT_PIPE_ID]" << endl << nextPipeId << endl;
-        outFile << "[NEXT_STATION_ID]" << endl << nextStationId << endl;
-        
-        outFile << "[USED_PIPE_IDS]" << endl;
-        for (int id : usedPipeIds) {
-            outFile << id << " ";
-        }
-        outFile << endl;
-        
-        outFile << "[USED_STATION_IDS]" << endl;
-        for (int id : usedStationIds) {
-            outFile << id << " ";
+        if (replicationFeed.active()) {
+            cout << "Serving followers on " << replicationServer->socketPath() << "\n";
+            if (replicationFeed.droppedEvents() > 0) {
+                cout << "Feed fell behind: " << replicationFeed.droppedEvents() << " event(s) replaced by a new snapshot\n";
+            }
+        } else {
+            cout << "Replication is stopped\n";
         }
-        outFile << endl;
+        cout << "1. Start serving followers\n";
+        cout << "2. Stop serving followers\n";
+        cout << "3. Follower status\n";
+        cout << "0. Back to main menu\n";
 
-        for (const auto& pair : pipes) {
-            outFile << PIPE_IDENTIFIER << endl;
-            outFile << pair.second;
-        }
+        int choice = getValidatedNumber("Choose action: ", 0, 3);
 
-        for (const auto& pair : stations) {
-            outFile << STATION_IDENTIFIER << endl;
-            outFile << pair.second;
+        switch (choice) {
+            case 1:
+                if (replicationFeed.active()) {
+                    cout << "Already serving followers on " << replicationServer->socketPath() << "\n";
+                } else {
+                    startReplication();
+                }
+                break;
+            case 2:
+                stopReplication();
+                break;
+            case 3:
+                if (replicationFeed.active()) {
+                    displayFollowers();
+                } else {
+                    cout << "Replication is stopped\n";
+                }
+                break;
+            case 0:
+                return;
         }
-
-        outFile.close();
-        cout << "Data successfully saved to " << filename << endl;
-        cout << "Saved: " << pipes.size() << " pipes, " << stations.size() << " stations\n";
     }
 
-    void loadData() {
-        string filename;
-        cout << "Enter filename to load (without extension): ";
-        getline(cin, filename);
-        filename += ".txt";
+    void reportIsolatedAreas() {
+        vector<vector<int>> areas = connectivity.takeIsolatedAreas();
+        size_t remainingStations = 0;
+        for (size_t i = 0; i < areas.size(); i++) {
+            if (i >= 10) {
+                remainingStations += areas[i].size();
+                continue;
+            }
+            cout << "Warning: " << areas[i].size() << " station(s) cut off from the rest of the network:";
+            for (size_t j = 0; j < areas[i].size() && j < 20; j++) {
+                cout << " " << areas[i][j];
+            }
+            cout << (areas[i].size() > 20 ? " ...\n" : "\n");
+        }
+        if (areas.size() > 10) {
+            cout << "Warning: " << areas.size() - 10 << " more area(s) with " << remainingStations << " station(s) cut off\n";
+        }
+    }
 
-        ifstream inFile(filename);
-        if (!inFile) {
-            cout << "Error: Could not open file " << filename << endl;
+    void refreshCriticalAnalysis() {
+        if (connectivity.analysisUpToDate()) {
             return;
         }
+        auto started = chrono::steady_clock::now();
+        connectivity.analyze();
+        double elapsed = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+        cout << "Network analyzed in " << elapsed << " s\n";
+    }
 
-        if (!pipes.empty() || !stations.empty()) {
-            if (!getConfirmation("Current data will be overwritten. Continue?")) {
-                cout << "Load cancelled.\n";
-                inFile.close();
-                return;
-            }
-        }
+    void criticalAnalysisMenu() {
+        cout << "\n=== CRITICAL PIPES AND STATIONS ===\n";
+        cout << "1. Critical pipes (failure splits the network)\n";
+        cout << "2. Critical stations (failure splits the network)\n";
+        cout << "3. Connected areas\n";
+        cout << "0. Back to main menu\n";
 
-        pipes.clear();
-        stations.clear();
-        usedPipeIds.clear();
-        usedStationIds.clear();
-        
-        string line;
-        bool readingUsedPipeIds = false;
-        bool readingUsedStationIds = false;
+        int choice = getValidatedNumber("Choose report: ", 0, 3);
 
-        while (getline(inFile, line)) {
-            if (line == "[NEXT_PIPE_ID]") {
-                string idStr;
-                getline(inFile, idStr);
-                nextPipeId = stoi(idStr);
-            }
-            else if (line == "[NEXT_STATION_ID]") {
-                string idStr;
-                getline(inFile, idStr);
-                nextStationId = stoi(idStr);
-            }
-            else if (line == "[USED_PIPE_IDS]") {
-                string idsStr;
-                getline(inFile, idsStr);
-                stringstream ss(idsStr);
-                int id;
-                while (ss >> id) {
-                    usedPipeIds.insert(id);
+        switch (choice) {
+            case 1: {
+                refreshCriticalAnalysis();
+                vector<int> critical = connectivity.bridgePipes();
+                if (critical.empty()) {
+                    cout << "No critical pipes.\n";
+                } else {
+                    displayFound(pipes, critical);
                 }
+                break;
             }
-            else if (line == "[USED_STATION_IDS]") {
-                string idsStr;
-                getline(inFile, idsStr);
-                stringstream ss(idsStr);
-                int id;
-                while (ss >> id) {
-                    usedStationIds.insert(id);
+            case 2: {
+                refreshCriticalAnalysis();
+                const vector<int>& critical = connectivity.articulationPoints();
+                if (critical.empty()) {
+                    cout << "No critical stations.\n";
+                } else {
+                    displayFound(stations, critical);
                 }
+                break;
             }
-            else if (line == PIPE_IDENTIFIER) {
-                Pipe pipe;
-                inFile >> pipe;
-                pipes[pipe.id] = pipe;
-            }
-            else if (line == STATION_IDENTIFIER) {
-                CompressorStation station;
-                inFile >> station;
-                stations[station.id] = station;
+            case 3: {
+                vector<size_t> sizes = connectivity.areaSizes();
+                size_t single = count(sizes.begin(), sizes.end(), size_t(1));
+                cout << "Connected areas: " << sizes.size() << " (" << single << " single station(s))\n";
+                for (size_t i = 0; i < sizes.size() && i < 10 && sizes[i] > 1; i++) {
+                    cout << i + 1 << ". " << sizes[i] << " station(s)\n";
+                }
+                break;
             }
+            case 0:
+                return;
         }
-
-        inFile.close();
-        cout << "Data successfully loaded from " << filename << endl;
-        cout << "Loaded: " << pipes.size() << " pipes, " << stations.size() << " stations\n";
-        cout << "Next available IDs - Pipe: " << nextPipeId << ", Station: " << nextStationId << endl;
     }
 
     void viewAllObjects() {
         cout << "\n=== CURRENT STATE ===\n";
-        displayAllPipes();
-        displayAllStations();
+        displayAll(pipes);
+        displayAll(stations);
+    }
+
+    // Starts as a read-only follower of the primary serving on `path`.
+    bool startFollowing(const string& path) {
+        if (!LocalSocket::supported()) {
+            cout << "Replication needs Unix domain sockets, which are not available on this system.\n";
+            return false;
+        }
+
+        follower = make_unique<ReplicationFollower>(path, stateMutex,
+            [this](const string& text) { applyReplicatedSnapshot(text); },
+            [this](const vector<string>& lines) { applyReplicatedEvents(lines); });
+        if (!follower->start()) {
+            cout << "Error: Could not connect to primary at " << path << endl;
+            follower.reset();
+            return false;
+        }
+        cout << "Following primary at " << path << " (read-only)\n";
+        return true;
     }
 
     void run() {
         int choice = -1;
+        unique_lock<mutex> state(stateMutex);
+        UnlockingInputBuffer input(cin, stateMutex);
 while (true) {
             cout << "\nMain Menu:\n"
                 << "1. Add Pipe\n"
@@ -881,6 +8334,22 @@ while (true) {
                 << "12. Batch Delete Stations\n"
                 << "13. Save Data\n"
                 << "14. Load Data\n"
+                << "15. Browse Objects\n"
+                << "16. Compact Saved Data\n"
+                << "17. Save Compressed Snapshot\n"
+                << "18. Load Compressed Snapshot\n"
+                << "19. Network Statistics\n"
+                << "20. Event History\n"
+                << "21. Change Feed\n"
+                << "22. Connect Pipe to Stations\n"
+                << "23. Simulate Gas Flow\n"
+                << "24. Prioritize Repairs\n"
+                << "25. Point-in-Time Queries\n"
+                << "26. Spatial Queries\n"
+                << "27. Critical Pipes and Stations\n"
+                << "28. Arrow Export and Import\n"
+                << "29. Replication\n"
+                << "30. Regions\n"
                 << "0. Exit\n"
                 << "Choose action: ";
 
@@ -899,13 +8368,17 @@ while (true) {
                 continue;
             }
 
+            if (changesState(choice) && !ensureWritable()) {
+                continue;
+            }
+
             switch (choice) {
             case 1:
-                addPipe();
+                addRecord(pipes);
                 break;
 
             case 2:
-                addStation();
+                addRecord(stations);
                 break;
 
             case 3:
@@ -921,11 +8394,11 @@ while (true) {
                 break;
 
             case 6:
-                deletePipe();
+                deleteRecord(pipes);
                 break;
 
             case 7:
-                deleteStation();
+                deleteRecord(stations);
                 break;
 
             case 8:
@@ -956,6 +8429,70 @@ while (true) {
                 loadData();
                 break;
 
+            case 15:
+                browseObjectsMenu();
+                break;
+
+            case 16:
+                compactData();
+                break;
+
+            case 17:
+                saveCompressedSnapshot();
+                break;
+
+            case 18:
+                loadCompressedSnapshot();
+                break;
+
+            case 19:
+                statisticsMenu();
+                break;
+
+            case 20:
+                historyMenu();
+                break;
+
+            case 21:
+                changeFeedMenu();
+                break;
+
+            case 22:
+                connectPipe();
+                break;
+
+            case 23:
+                runSimulation();
+                break;
+
+            case 24:
+                prioritizeRepairs();
+                break;
+
+            case 25:
+                timeTravelMenu();
+                break;
+
+            case 26:
+                spatialMenu();
+                break;
+
+            case 27:
+                criticalAnalysisMenu();
+                break;
+
+            case 28:
+                arrowMenu();
+                break;
+
+            case 29:
+                replicationMenu();
+                break;
+
+            case 30:
+                regionsMenu();
+                break;
+
             case 0:
                 cout << "Exiting program...\n";
                 return;
@@ -963,16 +8500,31 @@ while (true) {
             default:
                 cout << "Invalid choice! Try again.\n";
             }
+            reportIsolatedAreas();
         }
     }
 };
 
-ostream& operator<<(ostream& out, const Pipe& pipe) {
+OutputBuffer& operator<<(OutputBuffer& out, const Pipe& pipe) {
     out << "ID: " << pipe.id
         << " | Name: " << pipe.name
         << " | Length: " << pipe.length << " km"
         << " | Diameter: " << pipe.diameter << " mm"
-        << " | Under repair: " << (pipe.underRepair ? "Yes" : "No") << "\n";
+        << " | Under repair: " << (pipe.underRepair ? "Yes" : "No");
+    if (pipe.startStationId != 0 || pipe.endStationId != 0) {
+        out << " | Route: " << pipe.startStationId << " -> " << pipe.endStationId;
+    }
+    if (pipe.hasGeometry()) {
+        out << " | Geometry: " << ExactDouble{ pipe.startX } << ", " << ExactDouble{ pipe.startY }
+            << " -> " << ExactDouble{ pipe.endX } << ", " << ExactDouble{ pipe.endY };
+    }
+    out << "\n";
+    return out;
+}
+
+ostream& operator<<(ostream& out, const Pipe& pipe) {
+    OutputBuffer buffer(out, 256);
+    buffer << pipe;
     return out;
 }
 
@@ -988,11 +8540,21 @@ istream& operator>>(istream& in, Pipe& pipe) {
     return in;
 }
 
-ostream& operator<<(ostream& out, const CompressorStation& station) {
+OutputBuffer& operator<<(OutputBuffer& out, const CompressorStation& station) {
     out << "ID: " << station.id
         << " | Name: " << station.name
         << " | Workshops: " << station.activeWorkshops << "/" << station.totalWorkshops
-        << " | Class: " << station.stationClass << "\n";
+        << " | Class: " << station.stationClass;
+    if (station.hasLocation()) {
+        out << " | Location: " << ExactDouble{ station.x } << ", " << ExactDouble{ station.y };
+    }
+    out << "\n";
+    return out;
+}
+
+ostream& operator<<(ostream& out, const CompressorStation& station) {
+    OutputBuffer buffer(out, 256);
+    buffer << station;
     return out;
 }
 
@@ -1006,11 +8568,58 @@ istream& operator>>(istream& in, CompressorStation& station) {
     in >> station.activeWorkshops;
     cout << "Enter station class: ";
     in >> station.stationClass;
+    cout << "Is the location known? (y/n): ";
+    string answer;
+    in >> answer;
+    station.locationKnown = answer == "y" || answer == "Y";
+    if (station.locationKnown) {
+        station.x = readCoordinate(in, "Enter location X (km): ");
+        station.y = readCoordinate(in, "Enter location Y (km): ");
+    }
     return in;
 }
 
-int main() {
+OutputBuffer& operator<<(OutputBuffer& out, const ChangeEvent& event) {
+    static const char* const OPERATIONS[] = { "INSERT", "UPDATE", "DELETE", "RESET" };
+    out << event.sequence << " " << event.timestamp << " " << OPERATIONS[static_cast<int>(event.operation)];
+    if (event.operation == ChangeOperation::Reset) {
+        if (event.droppedTo != 0) {
+            out << " | Dropped: " << event.droppedFrom << "-" << event.droppedTo << " | Pipes:";
+            for (int id : event.droppedPipes) {
+                out << " " << id;
+            }
+            out << " | Stations:";
+            for (int id : event.droppedStations) {
+                out << " " << id;
+            }
+        }
+        out << "\n";
+        return out;
+    }
+
+    out << (event.entity == EntityType::Pipe ? " PIPE " : " STATION ") << event.id;
+    if (event.operation == ChangeOperation::Delete) {
+        out << "\n";
+    } else if (event.entity == EntityType::Pipe) {
+        out << " | " << event.pipe;
+    } else {
+        out << " | " << event.station;
+    }
+    return out;
+}
+
+int main(int argc, char* argv[]) {
     DataManager manager;
+    if (argc == 3 && string(argv[1]) == "--follow") {
+        if (!manager.startFollowing(argv[2])) {
+            return 1;
+        }
+    } else if ((argc == 3 || argc == 4) && string(argv[1]) == "--subscribe") {
+        return subscribeToChangeFeed(argv[2], argc == 4 ? strtoull(argv[3], nullptr, 10) : 1) ? 0 : 1;
+    } else if (argc != 1) {
+        cout << "Usage: " << argv[0] << " [--follow <socket path> | --subscribe <socket path> [<sequence>]]\n";
+        return 1;
+    }
     manager.run();
     return 0;
 }